@@ -0,0 +1,120 @@
+#include "../muhev.hpp"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Wake-to-callback latency percentiles with and without busy polling: a
+// producer thread fires a light trigger and the callback measures how late
+// it runs. Then the CPU a busy-polling loop burns while idle.
+//
+//     bench_busy_poll [samples]
+
+using namespace NAC::NMuhEv;
+
+namespace {
+    static uint64_t NowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+    }
+
+    static void Latency(uint64_t budgetUs, uint64_t gapUs, size_t samples) {
+        TLoop loop;
+        loop.SetBusyPoll(budgetUs);
+
+        std::atomic<uint64_t> sent(0);
+        std::atomic<bool> ack(true);
+        std::vector<uint64_t> latency;
+        latency.reserve(samples);
+
+        auto trigger = loop.NewLightTrigger([&]() {
+            latency.push_back(NowNs() - sent.load());
+            ack = true;
+        });
+
+        std::thread producer([&]() {
+            for (size_t i = 0; i < samples; ++i) {
+                while (!ack.load()) {
+                    std::this_thread::yield();
+                }
+
+                ack = false;
+
+                // Gives the loop time to fall asleep, or not
+                const uint64_t until = NowNs() + gapUs * 1000;
+
+                while (NowNs() < until) {
+                    std::this_thread::yield();
+                }
+
+                sent = NowNs();
+                trigger->Trigger();
+            }
+        });
+
+        while (latency.size() < samples) {
+            loop.Wait();
+        }
+
+        producer.join();
+        std::sort(latency.begin(), latency.end());
+
+        printf(
+            "budget=%4luus gap=%4luus p50=%-7lu p99=%-7lu p999=%-7lu ns\n",
+            (unsigned long)budgetUs,
+            (unsigned long)gapUs,
+            (unsigned long)latency[samples / 2],
+            (unsigned long)latency[samples * 99 / 100],
+            (unsigned long)latency[samples * 999 / 1000]
+        );
+    }
+
+    static void Idle(uint64_t budgetUs) {
+        TLoop loop;
+        loop.SetBusyPoll(budgetUs);
+
+        size_t fired = 0;
+        auto timer = loop.NewTimer([&fired]() {
+            ++fired;
+        });
+
+        const clock_t start = clock();
+
+        for (size_t i = 0; i < 100; ++i) {
+            loop.Schedule(*timer, 2);
+
+            while (fired <= i) {
+                loop.Wait();
+            }
+        }
+
+        printf(
+            "budget=%4luus idle: %.1f ms CPU over 100 2ms waits\n",
+            (unsigned long)budgetUs,
+            (clock() - start) * 1000.0 / CLOCKS_PER_SEC
+        );
+    }
+}
+
+int main(int argc, char** argv) {
+    const size_t samples = ((argc > 1) ? atoi(argv[1]) : 20000);
+    const uint64_t budgets[] = {0, 50, 200};
+    const uint64_t gaps[] = {0, 20, 100};
+
+    for (const uint64_t budget : budgets) {
+        for (const uint64_t gap : gaps) {
+            Latency(budget, gap, samples);
+        }
+    }
+
+    for (const uint64_t budget : budgets) {
+        Idle(budget);
+    }
+
+    return 0;
+}
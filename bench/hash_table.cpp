@@ -0,0 +1,153 @@
+#include "../hash_table.hpp"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+
+// Random lookups per second in a static (perfect hash) and a mutable hash
+// table file with the given number of 8-byte keys and values, hits and
+// misses. Building keeps about 40 bytes per key in memory, so 1B keys
+// needs a machine with room for that; the files go to dir.
+//
+//     bench_hash_table [keys] [lookups] [dir]
+
+using namespace NAC;
+
+namespace {
+    using TClock = std::chrono::steady_clock;
+
+    static double Seconds(TClock::time_point start) {
+        return std::chrono::duration<double>(TClock::now() - start).count();
+    }
+
+    static uint64_t Next(uint64_t& state) {
+        // splitmix64
+        uint64_t out = (state += 0x9E3779B97F4A7C15ULL);
+        out = (out ^ (out >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        out = (out ^ (out >> 27)) * 0x94D049BB133111EBULL;
+
+        return (out ^ (out >> 31));
+    }
+
+    // Keys [0, keys) are present, [keys, 2 * keys) aren't
+    template<typename TTable>
+    static void Lookups(const char* name, const TTable& table, uint64_t keys, uint64_t lookups, bool hits) {
+        uint64_t state = (hits ? 1 : 2);
+        uint64_t found = 0;
+        TBlob value;
+
+        const auto start = TClock::now();
+
+        for (uint64_t i = 0; i < lookups; ++i) {
+            const uint64_t key = (Next(state) % keys) + (hits ? 0 : keys);
+
+            if (table.Find(sizeof(key), (const char*)&key, value)) {
+                ++found;
+            }
+        }
+
+        const double seconds = Seconds(start);
+
+        printf(
+            "%-8s %-6s %8.2fM lookups/s (%lu found)\n",
+            name,
+            (hits ? "hits" : "misses"),
+            lookups / seconds / 1e6,
+            (unsigned long)found
+        );
+    }
+
+    static bool Static(const std::string& path, uint64_t keys, uint64_t lookups) {
+        unlink(path.c_str());
+
+        auto start = TClock::now();
+
+        {
+            TFile file(path, TFile::ACCESS_CREATE);
+
+            if (!file) {
+                return false;
+            }
+
+            THashTableBuilder builder(file);
+
+            for (uint64_t i = 0; i < keys; ++i) {
+                const uint64_t value = i * 3;
+                builder.Add(sizeof(i), (const char*)&i, sizeof(value), (const char*)&value);
+            }
+
+            if (!builder.Finish()) {
+                return false;
+            }
+        }
+
+        printf("static   build  %8.2f s\n", Seconds(start));
+
+        TFile file(path);
+        THashTable table(file);
+
+        if (!table) {
+            return false;
+        }
+
+        Lookups("static", table, keys, lookups, true);
+        Lookups("static", table, keys, lookups, false);
+
+        unlink(path.c_str());
+
+        return true;
+    }
+
+    static bool Mutable(const std::string& path, uint64_t keys, uint64_t lookups) {
+        unlink(path.c_str());
+
+        TFile file(path, TFile::ACCESS_CREATE);
+        TMutableHashTable table(file);
+
+        if (!table) {
+            return false;
+        }
+
+        const auto start = TClock::now();
+
+        for (uint64_t i = 0; i < keys; ++i) {
+            const uint64_t value = i * 3;
+
+            if (!table.Insert(sizeof(i), (const char*)&i, sizeof(value), (const char*)&value)) {
+                return false;
+            }
+        }
+
+        const double seconds = Seconds(start);
+
+        printf("mutable  insert %8.2fM inserts/s\n", keys / seconds / 1e6);
+
+        Lookups("mutable", table, keys, lookups, true);
+        Lookups("mutable", table, keys, lookups, false);
+
+        unlink(path.c_str());
+
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    const uint64_t keys = ((argc > 1) ? strtoull(argv[1], nullptr, 10) : 10000000);
+    const uint64_t lookups = ((argc > 2) ? strtoull(argv[2], nullptr, 10) : 10000000);
+    const std::string dir((argc > 3) ? argv[3] : ".");
+
+    printf("%lu keys, %lu lookups\n", (unsigned long)keys, (unsigned long)lookups);
+
+    if (!Static(dir + "/bench_hash_table.static", keys, lookups)) {
+        fprintf(stderr, "static table failed\n");
+        return 1;
+    }
+
+    if (!Mutable(dir + "/bench_hash_table.mutable", keys, lookups)) {
+        fprintf(stderr, "mutable table failed\n");
+        return 1;
+    }
+
+    return 0;
+}
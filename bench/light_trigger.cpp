@@ -0,0 +1,157 @@
+#include "../muhev.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Light triggers against fd-backed ones: creation, firing and dispatch
+// with 100k triggers on one loop.
+//
+//     bench_light_trigger [light triggers] [fd triggers]
+
+using namespace NAC::NMuhEv;
+
+namespace {
+    using TClock = std::chrono::steady_clock;
+
+    static double Seconds(TClock::time_point start) {
+        return std::chrono::duration<double>(TClock::now() - start).count();
+    }
+
+    static size_t Sum(const std::vector<uint32_t>& hits) {
+        size_t out = 0;
+
+        for (const uint32_t hit : hits) {
+            out += hit;
+        }
+
+        return out;
+    }
+
+    static double PostAndWait(TLoop& loop, size_t count) {
+        const auto start = TClock::now();
+
+        for (size_t i = 0; i < count; ++i) {
+            loop.Post([]() {});
+            loop.Wait();
+        }
+
+        return Seconds(start) / count;
+    }
+}
+
+int main(int argc, char** argv) {
+    const size_t lightCount = ((argc > 1) ? atoi(argv[1]) : 100000);
+    const size_t fdCount = ((argc > 2) ? atoi(argv[2]) : 10000);
+
+    TLoop loop;
+    std::vector<uint32_t> hits(lightCount);
+    std::vector<std::unique_ptr<TLightTrigger>> triggers;
+
+    auto start = TClock::now();
+
+    for (size_t i = 0; i < lightCount; ++i) {
+        triggers.emplace_back(loop.NewLightTrigger([&hits, i]() {
+            ++hits[i];
+        }));
+    }
+
+    printf("light: create %zu: %.1f ms\n", lightCount, Seconds(start) * 1e3);
+
+    start = TClock::now();
+
+    for (auto& trigger : triggers) {
+        trigger->Trigger();
+    }
+
+    double fire = Seconds(start);
+
+    start = TClock::now();
+    loop.Wait();
+    double dispatch = Seconds(start);
+
+    printf(
+        "light: fire all: %.1f ns/trigger, dispatch: %.1f ns/callback (%zu ran)\n",
+        fire / lightCount * 1e9,
+        dispatch / lightCount * 1e9,
+        Sum(hits)
+    );
+
+    // One random trigger at a time from another thread: wakeups coalesce
+    {
+        const size_t fires = 300000;
+        std::atomic<bool> done(false);
+
+        std::fill(hits.begin(), hits.end(), 0);
+
+        std::thread producer([&]() {
+            std::mt19937 rng(1);
+
+            for (size_t i = 0; i < fires; ++i) {
+                triggers[rng() % lightCount]->Trigger();
+            }
+
+            done = true;
+            loop.Wake();
+        });
+
+        start = TClock::now();
+
+        while (!done) {
+            loop.Wait();
+        }
+
+        producer.join();
+
+        const double seconds = Seconds(start);
+
+        printf(
+            "light: cross-thread random fires: %.2fM/s, %zu callbacks\n",
+            fires / seconds / 1e6,
+            Sum(hits)
+        );
+    }
+
+    printf("light: post+wait with %zu idle: %.0f ns\n", lightCount, PostAndWait(loop, 200000) * 1e9);
+    triggers.clear();
+    printf("light: post+wait with none: %.0f ns\n", PostAndWait(loop, 200000) * 1e9);
+
+    std::vector<uint32_t> fdHits(fdCount);
+    std::vector<std::unique_ptr<TTriggerNodeBase>> fdTriggers;
+
+    start = TClock::now();
+
+    for (size_t i = 0; i < fdCount; ++i) {
+        fdTriggers.emplace_back(loop.NewTrigger([&fdHits, i]() {
+            ++fdHits[i];
+        }));
+    }
+
+    printf("fd:    create %zu: %.1f ms\n", fdCount, Seconds(start) * 1e3);
+
+    start = TClock::now();
+
+    for (auto& trigger : fdTriggers) {
+        trigger->Trigger();
+    }
+
+    fire = Seconds(start);
+    start = TClock::now();
+
+    while (Sum(fdHits) < fdCount) {
+        loop.Wait(1000);
+    }
+
+    dispatch = Seconds(start);
+
+    printf(
+        "fd:    fire all: %.1f ns/trigger, dispatch: %.1f ns/callback\n",
+        fire / fdCount * 1e9,
+        dispatch / fdCount * 1e9
+    );
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include "../reactor_pool.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Echo round trips per second through a TReactorPool, for 1..N loops and
+// every accept mode.
+//
+//     bench_reactor_pool [max loops] [clients] [round trips per client]
+
+using namespace NAC::NMuhEv;
+
+namespace {
+    class TEchoNode : public TNode {
+    public:
+        TEchoNode(int fd)
+            : TNode(fd, MUHEV_FILTER_READ)
+        {
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        }
+
+        ~TEchoNode() {
+            if (Alive) {
+                close(EvIdent);
+            }
+        }
+
+        void Cb(int, int) override {
+            char buf[4096];
+
+            while (true) {
+                const ssize_t rv = read(EvIdent, buf, sizeof(buf));
+
+                if (rv > 0) {
+                    ssize_t offset = 0;
+
+                    while (offset < rv) {
+                        const ssize_t written = write(EvIdent, buf + offset, rv - offset);
+
+                        if (written <= 0) {
+                            break;
+                        }
+
+                        offset += written;
+                    }
+
+                    continue;
+                }
+
+                if ((rv == -1) && ((errno == EAGAIN) || (errno == EINTR))) {
+                    return;
+                }
+
+                close(EvIdent);
+                Alive = false;
+                return;
+            }
+        }
+
+        bool IsAlive() const override {
+            return Alive;
+        }
+
+    private:
+        bool Alive = true;
+    };
+
+    static int Connect(unsigned short port) {
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (fd == -1) {
+            perror("socket");
+            abort();
+        }
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("connect");
+            abort();
+        }
+
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        return fd;
+    }
+
+    static void Client(unsigned short port, size_t roundTrips) {
+        const int fd = Connect(port);
+        const char msg[] = "0123456789abcdef";
+        char buf[64];
+
+        for (size_t i = 0; i < roundTrips; ++i) {
+            if (write(fd, msg, sizeof(msg) - 1) != (ssize_t)(sizeof(msg) - 1)) {
+                perror("write");
+                abort();
+            }
+
+            size_t got = 0;
+
+            while (got < (sizeof(msg) - 1)) {
+                const ssize_t rv = read(fd, buf, sizeof(buf));
+
+                if (rv <= 0) {
+                    perror("read");
+                    abort();
+                }
+
+                got += rv;
+            }
+        }
+
+        close(fd);
+    }
+
+    static double Run(size_t loops, TReactorPool::EAcceptMode mode, size_t clients, size_t roundTrips) {
+        TReactorPool pool([](TLoop&, int fd) {
+            return std::unique_ptr<TNode>(new TEchoNode(fd));
+        }, loops, mode);
+
+        if (!pool.Listen("127.0.0.1", 0)) {
+            abort();
+        }
+
+        pool.Start();
+
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+
+        for (size_t i = 0; i < clients; ++i) {
+            threads.emplace_back(Client, pool.Port(), roundTrips);
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        pool.Stop();
+        pool.Join();
+
+        return ((clients * roundTrips) / seconds);
+    }
+}
+
+int main(int argc, char** argv) {
+    const size_t maxLoops = ((argc > 1) ? atoi(argv[1]) : std::thread::hardware_concurrency());
+    const size_t clients = ((argc > 2) ? atoi(argv[2]) : 16);
+    const size_t roundTrips = ((argc > 3) ? atoi(argv[3]) : 20000);
+
+    const struct {
+        TReactorPool::EAcceptMode Mode;
+        const char* Name;
+    } modes[] = {
+        {TReactorPool::ACCEPT_REUSEPORT, "reuseport"},
+        {TReactorPool::ACCEPT_ROUND_ROBIN, "round robin"},
+        {TReactorPool::ACCEPT_LEAST_LOADED, "least loaded"},
+    };
+
+    for (const auto& mode : modes) {
+        for (size_t loops = 1; loops <= maxLoops; loops *= 2) {
+            printf(
+                "%-12s loops=%-3zu %10.0f round trips/s\n",
+                mode.Name,
+                loops,
+                Run(loops, mode.Mode, clients, roundTrips)
+            );
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include "../thread_pool.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fine-grained tasks on TThreadPool for 1..N threads: ParallelFor with the
+// default and a grain of 1, recursive task groups, tasks spawned from
+// outside, and the last against a mutex + condvar queue for comparison.
+//
+//     bench_thread_pool [max threads]
+
+using namespace NAC::NBase;
+
+namespace {
+    using TClock = std::chrono::steady_clock;
+
+    static double Ns(TClock::time_point start, size_t count) {
+        return std::chrono::duration<double, std::nano>(TClock::now() - start).count() / count;
+    }
+
+    class TMutexPool {
+    public:
+        TMutexPool(size_t threads) {
+            for (size_t i = 0; i < threads; ++i) {
+                Threads.emplace_back([this]() {
+                    Run();
+                });
+            }
+        }
+
+        ~TMutexPool() {
+            {
+                std::lock_guard<std::mutex> guard(Mutex);
+                Stopping = true;
+            }
+
+            Cond.notify_all();
+
+            for (auto& thread : Threads) {
+                thread.join();
+            }
+        }
+
+        void Submit(std::function<void()>&& cb) {
+            {
+                std::lock_guard<std::mutex> guard(Mutex);
+                Queue.push_back(std::move(cb));
+            }
+
+            Cond.notify_one();
+        }
+
+    private:
+        void Run() {
+            while (true) {
+                std::function<void()> cb;
+
+                {
+                    std::unique_lock<std::mutex> guard(Mutex);
+
+                    Cond.wait(guard, [this]() {
+                        return (Stopping || !Queue.empty());
+                    });
+
+                    if (Queue.empty()) {
+                        return;
+                    }
+
+                    cb = std::move(Queue.front());
+                    Queue.pop_front();
+                }
+
+                cb();
+            }
+        }
+
+    private:
+        std::mutex Mutex;
+        std::condition_variable Cond;
+        std::deque<std::function<void()>> Queue;
+        bool Stopping = false;
+        std::vector<std::thread> Threads;
+    };
+
+    static long Fib(TThreadPool& pool, int n) {
+        if (n < 2) {
+            return n;
+        }
+
+        long a = 0;
+        TTaskGroup group(pool);
+
+        group.Run([&]() {
+            a = Fib(pool, n - 1);
+        });
+
+        const long b = Fib(pool, n - 2);
+        group.Wait();
+
+        return (a + b);
+    }
+
+    static void Run(size_t threads) {
+        const size_t count = 1000000;
+        std::vector<double> data(10 * count, 1.0);
+
+        {
+            TThreadPool pool(threads);
+            const auto cb = [&data](size_t i) {
+                data[i] = data[i] * 1.0000001 + 0.5;
+            };
+
+            auto start = TClock::now();
+
+            for (size_t i = 0; i < 10; ++i) {
+                pool.ParallelFor(0, data.size(), cb);
+            }
+
+            printf("threads=%-3zu ParallelFor:               %6.2f ns/index\n", threads, Ns(start, 10 * data.size()));
+
+            start = TClock::now();
+
+            for (size_t i = 0; i < 10; ++i) {
+                pool.ParallelFor(0, data.size(), cb, 1);
+            }
+
+            printf("threads=%-3zu ParallelFor, grain 1:      %6.2f ns/index\n", threads, Ns(start, 10 * data.size()));
+
+            // fib(25) makes 242785 calls, half of them spawn a task
+            start = TClock::now();
+            Fib(pool, 25);
+            printf("threads=%-3zu recursive TTaskGroup:      %6.2f ns/call\n", threads, Ns(start, 242785));
+
+            std::atomic<size_t> done(0);
+            start = TClock::now();
+
+            {
+                TTaskGroup group(pool);
+
+                for (size_t i = 0; i < count; ++i) {
+                    group.Run([&done]() {
+                        done.fetch_add(1, std::memory_order_relaxed);
+                    });
+                }
+            }
+
+            printf("threads=%-3zu TTaskGroup from outside:   %6.2f ns/task\n", threads, Ns(start, count));
+        }
+
+        {
+            TMutexPool pool(threads);
+            std::atomic<size_t> done(0);
+            const auto start = TClock::now();
+
+            for (size_t i = 0; i < count; ++i) {
+                pool.Submit([&done]() {
+                    done.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+
+            while (done.load() < count) {
+                std::this_thread::yield();
+            }
+
+            printf("threads=%-3zu mutex + condvar queue:     %6.2f ns/task\n", threads, Ns(start, count));
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const size_t maxThreads = ((argc > 1) ? atoi(argv[1]) : std::thread::hardware_concurrency());
+
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        Run(threads);
+    }
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "../muhev.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Cross-thread signalling through fd-backed triggers (eventfd or
+// EVFILT_USER): the rate a producer can fire one while the loop thread
+// runs it, and the round trip of two loops triggering each other.
+//
+//     bench_trigger [fires] [round trips]
+
+using namespace NAC::NMuhEv;
+
+namespace {
+    using TClock = std::chrono::steady_clock;
+
+    static double Seconds(TClock::time_point start) {
+        return std::chrono::duration<double>(TClock::now() - start).count();
+    }
+
+    static void Fire(size_t fires) {
+        TLoop loop;
+        std::atomic<bool> done(false);
+        size_t calls = 0;
+
+        auto trigger = loop.NewTrigger([&calls]() {
+            ++calls;
+        });
+
+        std::thread thread([&]() {
+            while (!done.load()) {
+                loop.Wait();
+            }
+        });
+
+        const auto start = TClock::now();
+
+        for (size_t i = 0; i < fires; ++i) {
+            trigger->Trigger();
+        }
+
+        const double seconds = Seconds(start);
+
+        done = true;
+        loop.Wake();
+        thread.join();
+
+        // Fires while one is pending skip the syscall and coalesce
+        printf(
+            "Trigger(): %.2fM fires/s, %zu callbacks for %zu fires\n",
+            fires / seconds / 1e6,
+            calls,
+            fires
+        );
+
+        const auto wakeStart = TClock::now();
+
+        for (size_t i = 0; i < fires; ++i) {
+            loop.Wake();
+        }
+
+        printf("Wake() with one pending already: %.1f ns\n", Seconds(wakeStart) / fires * 1e9);
+    }
+
+    static void PingPong(size_t roundTrips) {
+        TLoop left;
+        TLoop right;
+        std::atomic<bool> done(false);
+        size_t count = 0;
+
+        std::unique_ptr<TTriggerNodeBase> ping;
+        std::unique_ptr<TTriggerNodeBase> pong;
+
+        ping = right.NewTrigger([&pong]() {
+            pong->Trigger();
+        });
+
+        pong = left.NewTrigger([&]() {
+            if (++count < roundTrips) {
+                ping->Trigger();
+
+            } else {
+                done = true;
+            }
+        });
+
+        std::thread thread([&]() {
+            while (!done.load()) {
+                right.Wait();
+            }
+        });
+
+        const auto start = TClock::now();
+
+        ping->Trigger();
+
+        while (!done.load()) {
+            left.Wait();
+        }
+
+        const double seconds = Seconds(start);
+
+        right.Wake();
+        thread.join();
+
+        printf(
+            "ping-pong: %.2f us round trip, %.0f round trips/s\n",
+            seconds / roundTrips * 1e6,
+            roundTrips / seconds
+        );
+    }
+}
+
+int main(int argc, char** argv) {
+    const size_t fires = ((argc > 1) ? atoi(argv[1]) : 10000000);
+    const size_t roundTrips = ((argc > 2) ? atoi(argv[2]) : 100000);
+
+    Fire(fires);
+    PingPong(roundTrips);
+
+    return 0;
+}
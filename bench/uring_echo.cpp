@@ -0,0 +1,279 @@
+#include "../muhev_uring.hpp"
+#include "../utils/socket.hpp"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+// Echo over many loopback connections, served by one loop with epoll and
+// with io_uring (readiness, multishot receive with write(), multishot
+// receive with a write op). A forked client keeps a 64-byte message in
+// flight on each connection and prints round trips per second.
+//
+//     bench_uring_echo [connections] [seconds]
+
+using namespace NAC;
+using namespace NAC::NMuhEv;
+
+namespace {
+    enum EMode {
+        MODE_EPOLL,
+        MODE_URING_READINESS,
+        MODE_URING_RECV,
+        MODE_URING_RECV_WRITE_OP,
+    };
+
+    static const char* const ModeNames[] = {
+        "epoll",
+        "uring readiness",
+        "uring recv + write()",
+        "uring recv + write op",
+    };
+
+    static const size_t MSG_SIZE = 64;
+
+    class TReadinessConn : public TNode {
+    public:
+        TReadinessConn(int fd)
+            : TNode(fd, MUHEV_FILTER_READ)
+        {
+        }
+
+        ~TReadinessConn() {
+            close(EvIdent);
+        }
+
+        void Cb(int, int) override {
+            const ssize_t rv = read(EvIdent, Buf, sizeof(Buf));
+
+            if ((rv > 0) && (write(EvIdent, Buf, rv) != rv)) {
+                perror("write");
+                abort();
+            }
+        }
+
+    private:
+        char Buf[4096];
+    };
+
+    class TWriteOp : public TUringOp {
+    public:
+        using TUringOp::TUringOp;
+
+        void OnComplete(int, const char*) override {
+        }
+    };
+
+    class TRecvConn : public TUringOp {
+    public:
+        TRecvConn(TLoop& loop, int fd, bool writeOp)
+            : TUringOp(loop)
+            , Fd(fd)
+            , WriteOp(writeOp)
+            , Writer(loop)
+        {
+            if (!Recv(Fd)) {
+                abort();
+            }
+        }
+
+        ~TRecvConn() {
+            Cancel();
+            Writer.Cancel();
+            close(Fd);
+        }
+
+        void OnComplete(int res, const char* data) override {
+            if (res == -ENOBUFS) {
+                Recv(Fd);
+
+            } else if (res <= 0) {
+                return;
+
+            } else if (WriteOp) {
+                // The buffer is the loop's and goes back after this call
+                memcpy(Out, data, res);
+
+                if (!Writer.Write(Fd, Out, res)) {
+                    abort();
+                }
+
+            } else if (write(Fd, data, res) != res) {
+                perror("write");
+                abort();
+            }
+        }
+
+    private:
+        const int Fd;
+        const bool WriteOp;
+        TWriteOp Writer;
+        char Out[4096];
+    };
+
+    static void Client(unsigned short port, size_t connections, int seconds) {
+        std::vector<int> fds;
+        const int epoll = epoll_create1(0);
+        char msg[MSG_SIZE];
+        memset(msg, 'x', sizeof(msg));
+
+        for (size_t i = 0; i < connections; ++i) {
+            const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+            sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+            if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == -1) {
+                perror("connect");
+                _exit(1);
+            }
+
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev);
+
+            fds.push_back(fd);
+        }
+
+        for (const int fd : fds) {
+            if (send(fd, msg, sizeof(msg), 0) != (ssize_t)sizeof(msg)) {
+                perror("send");
+                _exit(1);
+            }
+        }
+
+        size_t roundTrips = 0;
+        std::vector<epoll_event> events(1024);
+        char buf[4096];
+        const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+
+        while (std::chrono::steady_clock::now() < until) {
+            const int count = epoll_wait(epoll, events.data(), events.size(), 100);
+
+            for (int i = 0; i < count; ++i) {
+                const ssize_t rv = recv(events[i].data.fd, buf, sizeof(buf), 0);
+
+                if (rv <= 0) {
+                    continue;
+                }
+
+                roundTrips += rv / MSG_SIZE;
+
+                if (send(events[i].data.fd, msg, MSG_SIZE * (rv / MSG_SIZE), 0) < 0) {
+                    perror("send");
+                    _exit(1);
+                }
+            }
+        }
+
+        printf("%10zu round trips/s", roundTrips / seconds);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    static void Run(EMode mode, size_t connections, int seconds) {
+        TLoop loop((mode == MODE_EPOLL) ? MUHEV_BACKEND_DEFAULT : MUHEV_BACKEND_URING);
+
+        if ((mode != MODE_EPOLL) && (loop.GetBackend() != MUHEV_BACKEND_URING)) {
+            printf("%-24s io_uring is not available\n", ModeNames[mode]);
+            return;
+        }
+
+        const int listener = NSocketUtils::Listen("127.0.0.1", 0, false, 4096);
+
+        if (listener == -1) {
+            abort();
+        }
+
+        const unsigned short port = NSocketUtils::LocalPort(listener);
+
+        printf("%-24s ", ModeNames[mode]);
+        fflush(stdout);
+
+        const pid_t pid = fork();
+
+        if (pid == -1) {
+            perror("fork");
+            abort();
+        }
+
+        if (pid == 0) {
+            close(listener);
+            Client(port, connections, seconds);
+        }
+
+        // Blocking accepts
+        fcntl(listener, F_SETFL, 0);
+
+        std::vector<std::unique_ptr<TNode>> conns;
+
+        for (size_t i = 0; i < connections; ++i) {
+            const int fd = accept(listener, nullptr, nullptr);
+
+            if (fd == -1) {
+                perror("accept");
+                abort();
+            }
+
+            if (!NSocketUtils::SetNonBlocking(fd)) {
+                abort();
+            }
+
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+            if ((mode == MODE_EPOLL) || (mode == MODE_URING_READINESS)) {
+                conns.emplace_back(new TReadinessConn(fd));
+                loop.AddEvent(*conns.back(), false);
+
+            } else {
+                conns.emplace_back(new TRecvConn(loop, fd, (mode == MODE_URING_RECV_WRITE_OP)));
+            }
+        }
+
+        close(listener);
+
+        while (waitpid(pid, nullptr, WNOHANG) != pid) {
+            loop.Wait(1024);
+        }
+
+        printf(", %zu connections\n", connections);
+    }
+}
+
+int main(int argc, char** argv) {
+    const size_t connections = ((argc > 1) ? atoi(argv[1]) : 10000);
+    const int seconds = ((argc > 2) ? atoi(argv[2]) : 3);
+
+    // The server and the client both hold one fd per connection
+    rlimit limit;
+
+    if ((getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < (connections + 64))) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, connections + 64);
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    for (int mode = MODE_EPOLL; mode <= MODE_URING_RECV_WRITE_OP; ++mode) {
+        Run((EMode)mode, connections, seconds);
+    }
+
+    return 0;
+}
@@ -0,0 +1,474 @@
+#include "external_sort.hpp"
+#include "worker_lite.hpp"
+#include "utils/htonll.hpp"
+
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+
+#define SPILL_WRITE_BUFFER (1024 * 1024)
+#define MIN_SORT_CHUNK 4096
+
+namespace NAC {
+    namespace {
+        class TSortWorker : public NBase::TWorkerLite {
+        public:
+            TSortWorker(std::function<void()>&& cb)
+                : Cb(std::move(cb))
+            {
+            }
+
+            ~TSortWorker() {
+                Join();
+            }
+
+            void Run() override {
+                Cb();
+            }
+
+        private:
+            std::function<void()> Cb;
+        };
+
+        static inline size_t PutVarint(char* out, uint64_t value) {
+            size_t len(0);
+
+            while (value >= 0x80) {
+                out[len++] = (char)((value & 0x7f) | 0x80);
+                value >>= 7;
+            }
+
+            out[len++] = (char)value;
+
+            return len;
+        }
+
+        static inline bool GetVarint(const char*& pos, const char* end, uint64_t& value) {
+            value = 0;
+
+            for (size_t shift = 0; (pos < end) && (shift < 64); shift += 7) {
+                const unsigned char byte(*(pos++));
+                value |= ((uint64_t)(byte & 0x7f) << shift);
+
+                if (!(byte & 0x80)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        static inline uint64_t KeyPrefix(const size_t size, const char* data) {
+            uint64_t out(0);
+
+            if (size > 0) {
+                memcpy(&out, data, std::min(size, sizeof(out)));
+            }
+
+            return ntoh(out);
+        }
+    }
+
+    // k-way merge of sorted sources through a loser tree: Tree[0] is the
+    // overall winner, Tree[1..k) hold the loser of each internal match
+    class TExternalSorter::TMerge {
+    public:
+        TMerge(const TExternalSorter& sorter)
+            : Sorter(sorter)
+        {
+        }
+
+        void AddMemory(const TEntry* begin, const TEntry* end, const char* base) {
+            Sources.emplace_back();
+
+            auto& source = Sources.back();
+            source.Entry = begin;
+            source.EntryEnd = end;
+            source.Base = base;
+        }
+
+        void AddRun(const char* begin, const char* end) {
+            Sources.emplace_back();
+
+            auto& source = Sources.back();
+            source.Pos = begin;
+            source.End = end;
+        }
+
+        bool Start() {
+            const size_t k(Sources.size());
+
+            for (auto& source : Sources) {
+                if (!Advance(source) && Error) {
+                    return false;
+                }
+            }
+
+            if (k == 0) {
+                return true;
+            }
+
+            std::vector<size_t> winners(2 * k);
+            Tree.assign(k, 0);
+
+            for (size_t i = 0; i < k; ++i) {
+                winners[k + i] = i;
+            }
+
+            for (size_t i = k - 1; i > 0; --i) {
+                const size_t a(winners[2 * i]);
+                const size_t b(winners[2 * i + 1]);
+
+                if (Beats(a, b)) {
+                    winners[i] = a;
+                    Tree[i] = b;
+
+                } else {
+                    winners[i] = b;
+                    Tree[i] = a;
+                }
+            }
+
+            Tree[0] = winners[1];
+
+            return true;
+        }
+
+        bool Next(TBlob& record) {
+            if (Tree.empty() || !Sources[Tree[0]].Valid) {
+                return false;
+            }
+
+            const TBlob& top(Sources[Tree[0]].Current);
+
+            if (Sorter.Aggregate) {
+                // Aggregate() may change the key part of Acc too
+                Key.Shrink(0);
+                Key.Append(top.Size(), top.Data());
+                Acc.Shrink(0);
+                Acc.Append(top.Size(), top.Data());
+                Pop();
+
+                while (Sources[Tree[0]].Valid && !Sorter.Less(Key, Sources[Tree[0]].Current)) {
+                    Sorter.Aggregate(Acc, Sources[Tree[0]].Current);
+                    Pop();
+                }
+
+                record.Wrap(Acc.Size(), Acc.Data());
+
+            } else {
+                record.Wrap(top.Size(), top.Data());
+                Pop();
+
+                if (Sorter.Unique) {
+                    while (Sources[Tree[0]].Valid && !Sorter.Less(record, Sources[Tree[0]].Current)) {
+                        Pop();
+                    }
+                }
+            }
+
+            return !Error;
+        }
+
+    private:
+        struct TSource {
+            const TEntry* Entry = nullptr;
+            const TEntry* EntryEnd = nullptr;
+            const char* Base = nullptr;
+            const char* Pos = nullptr;
+            const char* End = nullptr;
+            TBlob Current;
+            bool Valid = false;
+        };
+
+    private:
+        bool Advance(TSource& source) {
+            if (source.Base) {
+                source.Valid = (source.Entry < source.EntryEnd);
+
+                if (source.Valid) {
+                    source.Current.Wrap(source.Entry->Size, source.Base + source.Entry->Offset);
+                    ++source.Entry;
+                }
+
+                return source.Valid;
+            }
+
+            source.Valid = false;
+
+            if (source.Pos >= source.End) {
+                return false;
+            }
+
+            uint64_t size;
+
+            if (!GetVarint(source.Pos, source.End, size) || ((uint64_t)(source.End - source.Pos) < size)) {
+                Error = true;
+                return false;
+            }
+
+            source.Current.Wrap(size, source.Pos);
+            source.Pos += size;
+            source.Valid = true;
+
+            return true;
+        }
+
+        // Exhausted sources lose, ties go to the earlier source
+        bool Beats(size_t a, size_t b) const {
+            const TSource& left(Sources[a]);
+            const TSource& right(Sources[b]);
+
+            if (!right.Valid) {
+                return left.Valid;
+            }
+
+            if (!left.Valid) {
+                return false;
+            }
+
+            if (a < b) {
+                return !Sorter.Less(right.Current, left.Current);
+
+            } else {
+                return Sorter.Less(left.Current, right.Current);
+            }
+        }
+
+        void Pop() {
+            const size_t k(Sources.size());
+            size_t winner(Tree[0]);
+
+            Advance(Sources[winner]);
+
+            for (size_t node = (winner + k) / 2; node > 0; node /= 2) {
+                if (Beats(Tree[node], winner)) {
+                    std::swap(Tree[node], winner);
+                }
+            }
+
+            Tree[0] = winner;
+        }
+
+    private:
+        const TExternalSorter& Sorter;
+        std::vector<TSource> Sources;
+        std::vector<size_t> Tree;
+        TBlob Key;
+        TBlob Acc;
+        bool Error = false;
+    };
+
+    TExternalSorter::TExternalSorter(size_t memMax, const std::string& diskMask, size_t threads)
+        : MemMax(memMax)
+        , DiskMask(diskMask)
+        , Threads(threads)
+    {
+        if (Threads == 0) {
+            const long cpus(sysconf(_SC_NPROCESSORS_ONLN));
+            Threads = ((cpus > 0) ? cpus : 1);
+        }
+    }
+
+    TExternalSorter::~TExternalSorter() {
+    }
+
+    bool TExternalSorter::Less(const TBlob& a, const TBlob& b) const {
+        if (Less_) {
+            return Less_(a, b);
+        }
+
+        return (a.Cmp(b) < 0);
+    }
+
+    TExternalSorter& TExternalSorter::Add(const size_t size, const char* data) {
+        if (!Ok || Finished) {
+            return *this;
+        }
+
+        const size_t used(Buf.Size() + Entries.size() * sizeof(TEntry));
+
+        if ((Entries.size() > 0) && ((used + size + sizeof(TEntry)) > MemMax)) {
+            if (!Spill()) {
+                return *this;
+            }
+        }
+
+        if (!Buf.Data()) {
+            Buf.Reserve(std::max(MemMax, size));
+        }
+
+        Entries.emplace_back(TEntry{Buf.Size(), size, KeyPrefix(size, data)});
+        Buf.Append(size, data);
+
+        return *this;
+    }
+
+    void TExternalSorter::AddLines(const TFile& file, size_t chunkSize) {
+        auto it = file.Lines(chunkSize);
+        it.SetScanResistant();
+
+        while (it) {
+            auto line = it.Next();
+
+            if (line) {
+                Add(line);
+            }
+        }
+    }
+
+    void TExternalSorter::SortBuffer(std::vector<std::pair<size_t, size_t>>& chunks) {
+        const size_t n(Entries.size());
+        const size_t count(std::max((size_t)1, std::min(Threads, n / MIN_SORT_CHUNK)));
+        const char* base(Buf.Data());
+
+        chunks.clear();
+
+        for (size_t i = 0; i < count; ++i) {
+            chunks.emplace_back(n * i / count, n * (i + 1) / count);
+        }
+
+        auto sortChunk = [this, base](size_t begin, size_t end) {
+            if (Less_) {
+                std::sort(Entries.begin() + begin, Entries.begin() + end, [this, base](const TEntry& a, const TEntry& b) {
+                    return Less_(TBlob(a.Size, base + a.Offset), TBlob(b.Size, base + b.Offset));
+                });
+
+                return;
+            }
+
+            // Most comparisons are decided by the prefix without touching Buf
+            std::sort(Entries.begin() + begin, Entries.begin() + end, [base](const TEntry& a, const TEntry& b) {
+                if (a.Prefix != b.Prefix) {
+                    return (a.Prefix < b.Prefix);
+                }
+
+                return (TBlob(a.Size, base + a.Offset).Cmp(b.Size, base + b.Offset) < 0);
+            });
+        };
+
+        std::vector<std::unique_ptr<TSortWorker>> workers;
+
+        for (size_t i = 1; i < count; ++i) {
+            const auto& chunk(chunks[i]);
+
+            workers.emplace_back(new TSortWorker([&sortChunk, chunk]() {
+                sortChunk(chunk.first, chunk.second);
+            }));
+
+            workers.back()->Start();
+        }
+
+        sortChunk(chunks[0].first, chunks[0].second);
+
+        for (auto& worker : workers) {
+            worker->Join();
+        }
+    }
+
+    bool TExternalSorter::Spill() {
+        if (Entries.empty()) {
+            return true;
+        }
+
+        if (!Disk) {
+            Disk.reset(new TFile(DiskMask, TFile::ACCESS_TMP));
+        }
+
+        std::vector<std::pair<size_t, size_t>> chunks;
+        SortBuffer(chunks);
+
+        TMerge merge(*this);
+
+        for (const auto& chunk : chunks) {
+            merge.AddMemory(Entries.data() + chunk.first, Entries.data() + chunk.second, Buf.Data());
+        }
+
+        merge.Start();
+
+        const uint64_t begin(DiskOffset);
+        TBlob out;
+        TBlob record;
+        out.Reserve(SPILL_WRITE_BUFFER);
+
+        while (merge.Next(record)) {
+            char header[10];
+            const size_t headerSize(PutVarint(header, record.Size()));
+
+            if ((out.Size() + headerSize + record.Size()) > SPILL_WRITE_BUFFER) {
+                Disk->Append(out.Size(), out.Data());
+                DiskOffset += out.Size();
+                out.Shrink(0);
+            }
+
+            if ((headerSize + record.Size()) > SPILL_WRITE_BUFFER) {
+                Disk->Append(headerSize, header);
+                Disk->Append(record.Size(), record.Data());
+                DiskOffset += headerSize + record.Size();
+
+            } else {
+                out.Append(headerSize, header);
+                out.Append(record.Size(), record.Data());
+            }
+        }
+
+        Disk->Append(out.Size(), out.Data());
+        DiskOffset += out.Size();
+
+        Runs.emplace_back(TRun{begin, DiskOffset});
+
+        Buf.Shrink(0);
+        Entries.clear();
+
+        if (!*Disk) {
+            Ok = false;
+        }
+
+        return Ok;
+    }
+
+    bool TExternalSorter::Finish() {
+        if (!Ok || Finished) {
+            return Ok;
+        }
+
+        Finished = true;
+        Merge.reset(new TMerge(*this));
+
+        if (Disk) {
+            Disk->Stat();
+            Disk->Map();
+
+            if (!*Disk || (Disk->Size() < DiskOffset)) {
+                Ok = false;
+                return false;
+            }
+
+            for (const auto& run : Runs) {
+                Merge->AddRun(Disk->Data() + run.Offset, Disk->Data() + run.End);
+            }
+        }
+
+        // The last buffer is merged straight from memory
+        if (!Entries.empty()) {
+            std::vector<std::pair<size_t, size_t>> chunks;
+            SortBuffer(chunks);
+
+            for (const auto& chunk : chunks) {
+                Merge->AddMemory(Entries.data() + chunk.first, Entries.data() + chunk.second, Buf.Data());
+            }
+        }
+
+        Ok = Merge->Start();
+
+        return Ok;
+    }
+
+    bool TExternalSorter::Next(TBlob& record) {
+        if (!Ok || !Merge) {
+            return false;
+        }
+
+        return Merge->Next(record);
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "str.hpp"
+#include "file.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+namespace NAC {
+    // Sorts more records than fit in memory. Records are buffered up to
+    // memMax bytes, each full buffer is sorted (in parallel) and spilled as
+    // a run to one temporary file created from diskMask (mkstemp(3) style,
+    // like TMemDisk), then the runs are merged with a loser tree.
+    class TExternalSorter {
+    public:
+        using TLess = std::function<bool(const TBlob&, const TBlob&)>;
+        // Folds record into acc; records are folded in arbitrary groupings,
+        // so the operation must be associative
+        using TAggregate = std::function<void(TBlob& acc, const TBlob& record)>;
+
+    public:
+        TExternalSorter() = delete;
+        TExternalSorter(const TExternalSorter&) = delete;
+        // Merge refers back to the sorter
+        TExternalSorter(TExternalSorter&&) = delete;
+
+        // threads = 0 means one per online CPU
+        TExternalSorter(size_t memMax, const std::string& diskMask, size_t threads = 0);
+
+        ~TExternalSorter();
+
+        // Default order is TBlob::Cmp
+        void SetLess(TLess&& less) {
+            Less_ = std::move(less);
+        }
+
+        // Keep one of each group of equal records
+        void SetUnique(bool value = true) {
+            Unique = value;
+        }
+
+        // Merge equal records into one
+        void SetAggregate(TAggregate&& aggregate) {
+            Aggregate = std::move(aggregate);
+        }
+
+        TExternalSorter& Add(const size_t size, const char* data);
+
+        TExternalSorter& Add(const TBlob& record) {
+            return Add(record.Size(), record.Data());
+        }
+
+        TExternalSorter& Add(const std::string& record) {
+            return Add(record.size(), record.data());
+        }
+
+        template<typename... TArgs>
+        TExternalSorter& operator<<(TArgs&&... args) {
+            return Add(std::forward<TArgs&&>(args)...);
+        }
+
+        // Adds every line of file without the delimiter; reads bypass
+        // the page cache where possible
+        void AddLines(const TFile& file, size_t chunkSize = 1024 * 1024);
+
+        bool Finish();
+
+        // Records are returned in order. Unless aggregated, record points
+        // into the sorter's memory or the mapped spill file and stays valid
+        // until the sorter is destroyed; aggregated records are valid
+        // until the next call.
+        bool Next(TBlob& record);
+
+        explicit operator bool() const {
+            return Ok;
+        }
+
+        size_t RunCount() const {
+            return Runs.size();
+        }
+
+    private:
+        struct TEntry {
+            uint64_t Offset;
+            uint64_t Size;
+            // First bytes as a big-endian integer, orders like TBlob::Cmp
+            uint64_t Prefix;
+        };
+
+        struct TRun {
+            uint64_t Offset;
+            uint64_t End;
+        };
+
+        class TMerge;
+
+    private:
+        bool Less(const TBlob& a, const TBlob& b) const;
+        void SortBuffer(std::vector<std::pair<size_t, size_t>>& chunks);
+        bool Spill();
+
+    private:
+        size_t MemMax;
+        std::string DiskMask;
+        size_t Threads;
+        TLess Less_;
+        TAggregate Aggregate;
+        bool Unique = false;
+        bool Ok = true;
+        bool Finished = false;
+
+        TBlob Buf;
+        std::vector<TEntry> Entries;
+
+        std::unique_ptr<TFile> Disk;
+        uint64_t DiskOffset = 0;
+        std::vector<TRun> Runs;
+
+        std::unique_ptr<TMerge> Merge;
+    };
+}
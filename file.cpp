@@ -1,5 +1,6 @@
 #include "file.hpp"
 #include "utils/blkgetsize.hpp"
+#include "utils/memmem.hpp"
 
 #include <cstdint>
 #include <sys/mman.h>
@@ -45,14 +46,43 @@
 
 #endif
 
+#define SCAN_EVICT_BATCH (1024 * 1024)
+
 namespace NAC {
+    namespace {
+        static inline size_t PageSize() {
+            static const size_t pageSize(sysconf(_SC_PAGESIZE));
+
+            return pageSize;
+        }
+
+        static inline bool FAdvise(int fh, off_t offset, size_t size, int advice) {
+#ifdef POSIX_FADV_NORMAL
+            const int rv = posix_fadvise(fh, offset, size, advice);
+
+            if (rv != 0) {
+                errno = rv;
+                perror("posix_fadvise");
+                return false;
+            }
+#endif
+
+            return true;
+        }
+    }
+
     TBlob TFileChunkIterator::Next() {
         if (Fh == -1) {
             return TBlob();
         }
 
+        if (Sparse && (Offset >= DataEnd) && !SeekData()) {
+            Fh = -1;
+            return TBlob();
+        }
+
         size_t pos(0);
-        const size_t toRead(std::min(Chunk.Capacity(), Len - Offset));
+        const size_t toRead(std::min(Chunk.Capacity(), (Sparse ? DataEnd : Len) - Offset));
 
         while (pos < toRead) {
             const ssize_t rv = pread(Fh, Chunk.Data() + pos, Chunk.Capacity() - pos, Offset + pos);
@@ -75,8 +105,13 @@ namespace NAC {
             }
         }
 
+        ChunkOffset_ = Offset;
         Offset += pos;
 
+        if (ScanResistant) {
+            EvictConsumed(Offset >= Len);
+        }
+
         if (Offset >= Len) {
             Fh = -1;
         }
@@ -84,6 +119,76 @@ namespace NAC {
         return TBlob(pos, Chunk.Data());
     }
 
+    void TFileChunkIterator::EvictConsumed(bool force) {
+#ifdef POSIX_FADV_DONTNEED
+        if ((Offset <= EvictTo) || (!force && ((Offset - EvictTo) < SCAN_EVICT_BATCH))) {
+            return;
+        }
+
+        // The kernel drops only folios that fit into the range entirely,
+        // so each batch also covers the previous one to catch the folio
+        // that has been straddling the boundary
+        FAdvise(Fh, EvictFrom, Offset - EvictFrom, POSIX_FADV_DONTNEED);
+
+        EvictFrom = EvictTo;
+        EvictTo = Offset;
+#endif
+    }
+
+    bool TFileChunkIterator::SeekData() {
+        // lseek() moves the position TFile::Append() relies on
+        const off_t pos = lseek(Fh, 0, SEEK_CUR);
+        off_t data = lseek(Fh, Offset, SEEK_DATA);
+        off_t hole = -1;
+
+        if (data == -1) {
+            if (errno == ENXIO) {
+                data = Len;
+
+            } else {
+                perror("lseek");
+                Sparse = false;
+                DataEnd = Len;
+            }
+
+        } else {
+            hole = lseek(Fh, data, SEEK_HOLE);
+
+            if (hole == -1) {
+                perror("lseek");
+                hole = Len;
+            }
+        }
+
+        if ((pos != -1) && (lseek(Fh, pos, SEEK_SET) == -1)) {
+            perror("lseek");
+        }
+
+        if (!Sparse) {
+            return true;
+        }
+
+        if ((size_t)data > Len) {
+            data = Len;
+        }
+
+        if ((size_t)data > Offset) {
+            if (HoleCb) {
+                HoleCb(Offset, data - Offset);
+            }
+
+            Offset = data;
+        }
+
+        if (Offset >= Len) {
+            return false;
+        }
+
+        DataEnd = std::min((size_t)hole, Len);
+
+        return true;
+    }
+
     TBlob TFilePartIterator::Next() {
         while (true) {
             if ((Buf.Size() > 0) && (Buf.Size() >= Delimiter.Size())) {
@@ -149,51 +254,28 @@ namespace NAC {
     }
 
     TBlob TFilePartIterator::Find(const TBlob& chunk, size_t startingOffset) const {
-        const unsigned char firstByte(Delimiter[0]);
-        size_t offset(0);
-        const size_t sizeOffset(startingOffset + Delimiter.Size() - 1);
-
-        if (sizeOffset >= chunk.Size()) {
+        if ((startingOffset + Delimiter.Size()) > chunk.Size()) {
             return TBlob();
         }
 
-        const size_t size(chunk.Size() - sizeOffset);
-
-        while (true) {
-            if (offset >= size) {
-                return TBlob();
-            }
-
-            auto* addr = (char*)memchr(chunk.Data() + startingOffset + offset, firstByte, size - offset);
-
-            if (!addr) {
-                return TBlob();
-            }
-
-            if (Delimiter.Size() > 1) {
-                bool ok(true);
-
-                for (size_t i = 1; i < Delimiter.Size(); ++i) {
-                    if (addr[i] != Delimiter[i]) {
-                        ok = false;
-                        break;
-                    }
-                }
+        const char* addr = MemMem(
+            chunk.Size() - startingOffset,
+            chunk.Data() + startingOffset,
+            Delimiter.Size(),
+            Delimiter.Data()
+        );
 
-                if (!ok) {
-                    offset = (uintptr_t)addr - (uintptr_t)chunk.Data() - startingOffset + 1;
-                    continue;
-                }
-            }
+        if (!addr) {
+            return TBlob();
+        }
 
-            const size_t outSize((uintptr_t)addr - (uintptr_t)chunk.Data() - startingOffset);
+        const size_t outSize((uintptr_t)addr - (uintptr_t)chunk.Data() - startingOffset);
 
-            if (outSize > 0) {
-                return TBlob(outSize, chunk.Data() + startingOffset);
+        if (outSize > 0) {
+            return TBlob(outSize, chunk.Data() + startingOffset);
 
-            } else {
-                return TBlob();
-            }
+        } else {
+            return TBlob();
         }
     }
 
@@ -374,6 +456,110 @@ namespace NAC {
         return true;
     }
 
+    size_t TFile::Resident(size_t offset, size_t size) const {
+        if (!Ok || !Addr_ || (offset >= Len_)) {
+            return 0;
+        }
+
+        if ((size == 0) || (size > (Len_ - offset))) {
+            size = Len_ - offset;
+        }
+
+        const size_t pageSize(PageSize());
+        const size_t begin(offset - (offset % pageSize));
+        const size_t end(offset + size);
+        const size_t pageCount((end - begin + pageSize - 1) / pageSize);
+
+#ifdef __linux__
+        using TVecItem = unsigned char;
+#else
+        using TVecItem = char;
+#endif
+
+        TVecItem vec[4096];
+        size_t out(0);
+
+        for (size_t page = 0; page < pageCount; page += sizeof(vec)) {
+            const size_t batch(std::min(pageCount - page, sizeof(vec)));
+            const size_t batchBegin(begin + page * pageSize);
+            const size_t batchEnd(std::min(batchBegin + batch * pageSize, end));
+
+            if (mincore((char*)Addr_ + batchBegin, batchEnd - batchBegin, vec) == -1) {
+                perror("mincore");
+                return out;
+            }
+
+            for (size_t i = 0; i < batch; ++i) {
+                if (!(vec[i] & 1)) {
+                    continue;
+                }
+
+                const size_t pageBegin(std::max(batchBegin + i * pageSize, offset));
+                const size_t pageEnd(std::min(batchBegin + (i + 1) * pageSize, end));
+
+                out += pageEnd - pageBegin;
+            }
+        }
+
+        return out;
+    }
+
+    bool TFile::Evict(size_t offset, size_t size) const {
+        if (!Ok || (Fh == -1) || (offset >= Len_)) {
+            return false;
+        }
+
+        if ((size == 0) || (size > (Len_ - offset))) {
+            size = Len_ - offset;
+        }
+
+        if (Addr_) {
+            // Mapped pages are skipped by POSIX_FADV_DONTNEED, so unmap them
+            // from our page tables first
+            const size_t pageSize(PageSize());
+            const size_t begin(offset - (offset % pageSize));
+
+            if (madvise((char*)Addr_ + begin, offset + size - begin, MADV_DONTNEED) == -1) {
+                perror("madvise");
+                return false;
+            }
+        }
+
+#ifdef POSIX_FADV_DONTNEED
+        return FAdvise(Fh, offset, size, POSIX_FADV_DONTNEED);
+#else
+        return true;
+#endif
+    }
+
+    bool TFile::Prefetch(size_t offset, size_t size) const {
+        if (!Ok || (Fh == -1) || (offset >= Len_)) {
+            return false;
+        }
+
+        if ((size == 0) || (size > (Len_ - offset))) {
+            size = Len_ - offset;
+        }
+
+        if (Addr_) {
+            const size_t pageSize(PageSize());
+            const size_t begin(offset - (offset % pageSize));
+
+            if (madvise((char*)Addr_ + begin, offset + size - begin, MADV_WILLNEED) == -1) {
+                perror("madvise");
+                return false;
+            }
+
+            return true;
+        }
+
+#ifdef POSIX_FADV_WILLNEED
+        return FAdvise(Fh, offset, size, POSIX_FADV_WILLNEED);
+#else
+        return true;
+#endif
+    }
+
     TFile& TFile::Append(const size_t size, const char* data) {
         if (!Ok || (size == 0) || (Fh == -1)) {
             return *this;
@@ -4,6 +4,7 @@
 #include <sys/types.h>
 #include <string.h>
 #include <utility>
+#include <functional>
 #include "str.hpp"
 
 namespace NAC {
@@ -44,11 +45,44 @@ namespace NAC {
 
         void Seek(size_t offset) {
             Offset = offset;
+            EvictFrom = EvictTo = offset;
+            DataEnd = 0;
+        }
+
+        // File offset of the chunk returned by the last Next() call
+        size_t ChunkOffset() const {
+            return ChunkOffset_;
+        }
+
+        // Skip holes (SEEK_DATA/SEEK_HOLE) instead of reading zeros,
+        // cb(offset, size) is called for every skipped hole
+        void SetSparse(std::function<void(size_t, size_t)>&& cb = {}) {
+            Sparse = true;
+            HoleCb = std::move(cb);
+            DataEnd = 0;
+        }
+
+        // Drop pages that were already read from the page cache, so a
+        // large sequential scan doesn't push hot data out of it
+        void SetScanResistant(bool value = true) {
+            ScanResistant = value;
+            EvictFrom = EvictTo = Offset;
         }
 
+    private:
+        void EvictConsumed(bool force);
+        bool SeekData();
+
     private:
         TBlob Chunk;
         size_t Offset = 0;
+        bool ScanResistant = false;
+        size_t EvictFrom = 0;
+        size_t EvictTo = 0;
+        size_t ChunkOffset_ = 0;
+        bool Sparse = false;
+        size_t DataEnd = 0;
+        std::function<void(size_t, size_t)> HoleCb;
     };
 
     class TFilePartIterator : public TFileChunkIterator {
@@ -157,6 +191,10 @@ namespace NAC {
             return INode_;
         }
 
+        int Fd() const {
+            return Fh;
+        }
+
         char operator[](const size_t index) const {
             return Data()[index];
         }
@@ -172,6 +210,11 @@ namespace NAC {
         bool MSync() const;
         bool FSync() const;
 
+        // Page cache control, size == 0 means "up to the end of file"
+        size_t Resident(size_t offset = 0, size_t size = 0) const;
+        bool Evict(size_t offset = 0, size_t size = 0) const;
+        bool Prefetch(size_t offset = 0, size_t size = 0) const;
+
         TFile& Append(const size_t size, const char* data);
         TFile& Write(const off_t offset, const size_t size, const char* data);
 
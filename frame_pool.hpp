@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <new>
+
+namespace NAC {
+    namespace NUtils {
+        // Single-threaded size-class free list for short-lived blocks of
+        // similar sizes (coroutine frames, callback state). Blocks are
+        // cached until the pool is destroyed; sizes above MAX_SIZE go
+        // straight to malloc().
+        class TFramePool {
+        public:
+            static const size_t GRANULARITY = 64;
+            static const size_t MAX_SIZE = 4096;
+
+        public:
+            TFramePool() = default;
+            TFramePool(const TFramePool&) = delete;
+            TFramePool(TFramePool&&) = delete;
+
+            ~TFramePool() {
+                for (auto& head : FreeLists) {
+                    while (head) {
+                        TBlock* next = head->Next;
+                        free(head);
+                        head = next;
+                    }
+                }
+            }
+
+            void* Allocate(size_t size) {
+                const size_t index = Index(size);
+
+                if (index < CLASSES) {
+                    if (TBlock* block = FreeLists[index]) {
+                        FreeLists[index] = block->Next;
+                        return block;
+                    }
+
+                    size = (index + 1) * GRANULARITY;
+                }
+
+                void* out = malloc(size);
+
+                if (!out) {
+                    throw std::bad_alloc();
+                }
+
+                return out;
+            }
+
+            // size must be the one passed to Allocate()
+            void Free(void* ptr, size_t size) {
+                const size_t index = Index(size);
+
+                if (index < CLASSES) {
+                    TBlock* block = (TBlock*)ptr;
+                    block->Next = FreeLists[index];
+                    FreeLists[index] = block;
+
+                } else {
+                    free(ptr);
+                }
+            }
+
+        private:
+            struct TBlock {
+                TBlock* Next;
+            };
+
+            static const size_t CLASSES = MAX_SIZE / GRANULARITY;
+
+            static size_t Index(size_t size) {
+                return ((size == 0) ? 0 : ((size - 1) / GRANULARITY));
+            }
+
+        private:
+            TBlock* FreeLists[CLASSES] = { nullptr };
+        };
+    }
+}
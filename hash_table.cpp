@@ -0,0 +1,762 @@
+#include "hash_table.hpp"
+#include "utils/hash.hpp"
+#include "utils/htonll.hpp"
+
+#include <string.h>
+#include <stdexcept>
+#include <algorithm>
+
+namespace NAC {
+    using namespace NHashUtils;
+
+    namespace {
+        static const char MAGIC[9] = "ACHASH01";
+        static const size_t HEADER_SIZE = 64;
+        static const size_t MUTABLE_SLOT_SIZE = 16;
+        static const size_t MUTABLE_HEAP_MIN = 4096;
+        static const uint64_t PILOT_MAX = (1 << 24);
+        static const uint64_t SEED_ATTEMPTS = 16;
+        static const uint64_t SLOT_MIX = 0x9e3779b97f4a7c15ull;
+
+        enum EMode : uint64_t {
+            MODE_STATIC = 0,
+            MODE_MUTABLE = 1,
+        };
+
+        enum EHeaderField {
+            HEADER_MODE = 8,
+            HEADER_SEED = 16,
+            HEADER_COUNT = 24,
+            // static: bucket count, mutable: capacity
+            HEADER_A = 32,
+            // static: slot count, mutable: heap end
+            HEADER_B = 40,
+            // static: pilots offset, mutable: heap start
+            HEADER_C = 48,
+            // static: slots offset, mutable: dead heap bytes
+            HEADER_D = 56,
+        };
+
+        enum ERecordFlag : unsigned char {
+            RECORD_DEAD = 0,
+            RECORD_LIVE = 1,
+        };
+
+        template<typename T>
+        static inline void Put(char* out, T value) {
+            value = hton(value);
+            memcpy(out, &value, sizeof(value));
+        }
+
+        template<typename T>
+        static inline T Get(const char* data) {
+            T value;
+            memcpy(&value, data, sizeof(value));
+
+            return ntoh(value);
+        }
+
+        static inline size_t PutVarint(char* out, uint64_t value) {
+            size_t len(0);
+
+            while (value >= 0x80) {
+                out[len++] = (char)((value & 0x7f) | 0x80);
+                value >>= 7;
+            }
+
+            out[len++] = (char)value;
+
+            return len;
+        }
+
+        static inline const char* GetVarint(const char* data, uint64_t& value) {
+            value = 0;
+
+            for (size_t shift = 0; shift < 64; shift += 7) {
+                const unsigned char byte(*(data++));
+                value |= ((uint64_t)(byte & 0x7f) << shift);
+
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+
+            return data;
+        }
+
+        static inline const char* ReadRecord(const char* record, TBlob& key, TBlob& value) {
+            uint64_t keySize;
+            uint64_t valueSize;
+
+            record = GetVarint(record, keySize);
+            record = GetVarint(record, valueSize);
+
+            key.Wrap(keySize, record);
+            value.Wrap(valueSize, record + keySize);
+
+            return record + keySize + valueSize;
+        }
+
+        // Including the liveness byte
+        static inline uint64_t MutableRecordSize(const char* record) {
+            TBlob key;
+            TBlob value;
+
+            return (ReadRecord(record + 1, key, value) - record);
+        }
+
+        static inline bool RecordKeyEquals(const char* record, const size_t keySize, const char* key, TBlob& value) {
+            TBlob recordKey;
+            ReadRecord(record, recordKey, value);
+
+            return (recordKey.Cmp(keySize, key) == 0);
+        }
+
+        static inline uint64_t SlotOf(uint64_t hash, uint32_t pilot, uint64_t slotCount) {
+            return FastRange(Mum(hash, SLOT_MIX * ((uint64_t)pilot + 1)), slotCount);
+        }
+
+        static inline uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+            return ((value + alignment - 1) / alignment) * alignment;
+        }
+
+        static bool FindStatic(const char* data, const size_t keySize, const char* key, TBlob& value) {
+            const uint64_t seed(Get<uint64_t>(data + HEADER_SEED));
+            const uint64_t bucketCount(Get<uint64_t>(data + HEADER_A));
+            const uint64_t slotCount(Get<uint64_t>(data + HEADER_B));
+
+            if (slotCount == 0) {
+                return false;
+            }
+
+            const uint64_t hash(Hash64(keySize, key, seed));
+            const uint32_t pilot(Get<uint32_t>(data + Get<uint64_t>(data + HEADER_C) + FastRange(hash, bucketCount) * sizeof(uint32_t)));
+            const uint64_t slot(SlotOf(hash, pilot, slotCount));
+            const uint64_t offset(Get<uint64_t>(data + Get<uint64_t>(data + HEADER_D) + slot * sizeof(uint64_t)));
+
+            if (offset == 0) {
+                return false;
+            }
+
+            TBlob found;
+
+            if (!RecordKeyEquals(data + offset, keySize, key, found)) {
+                return false;
+            }
+
+            value.Wrap(found.Size(), found.Data());
+
+            return true;
+        }
+
+        // Returns slot index where the key is or where it would be inserted
+        static uint64_t ProbeMutable(const char* data, const uint64_t hash, const size_t keySize, const char* key, bool& found) {
+            const uint64_t capacity(Get<uint64_t>(data + HEADER_A));
+            uint64_t i(FastRange(hash, capacity));
+            TBlob value;
+
+            while (true) {
+                const char* slot(data + HEADER_SIZE + i * MUTABLE_SLOT_SIZE);
+                const uint64_t offset(Get<uint64_t>(slot + 8));
+
+                if (offset == 0) {
+                    found = false;
+                    return i;
+                }
+
+                if ((Get<uint64_t>(slot) == hash) && RecordKeyEquals(data + offset + 1, keySize, key, value)) {
+                    found = true;
+                    return i;
+                }
+
+                if (++i == capacity) {
+                    i = 0;
+                }
+            }
+        }
+
+        static bool FindMutable(const char* data, const size_t keySize, const char* key, TBlob& value) {
+            bool found;
+            const uint64_t hash(Hash64(keySize, key, Get<uint64_t>(data + HEADER_SEED)));
+            const uint64_t i(ProbeMutable(data, hash, keySize, key, found));
+
+            if (!found) {
+                return false;
+            }
+
+            TBlob recordKey;
+            ReadRecord(data + Get<uint64_t>(data + HEADER_SIZE + i * MUTABLE_SLOT_SIZE + 8) + 1, recordKey, value);
+
+            return true;
+        }
+
+        static bool CheckHeader(const size_t size, const char* data, EMode mode) {
+            return (
+                data
+                && (size >= HEADER_SIZE)
+                && (memcmp(data, MAGIC, 8) == 0)
+                && (Get<uint64_t>(data + HEADER_MODE) == mode)
+            );
+        }
+    }
+
+    THashTableBuilder::THashTableBuilder(TFile& file)
+        : File(file)
+    {
+        const char header[HEADER_SIZE] = { 0 };
+
+        File.Append(HEADER_SIZE, header);
+        Offset = HEADER_SIZE;
+    }
+
+    void THashTableBuilder::Add(const size_t keySize, const char* key, const size_t valueSize, const char* value) {
+        char header[20];
+        size_t headerSize(PutVarint(header, keySize));
+        headerSize += PutVarint(header + headerSize, valueSize);
+
+        Buf.Shrink(0);
+        Buf.Append(headerSize, header);
+        Buf.Append(keySize, key);
+        Buf.Append(valueSize, value);
+
+        File.Append(Buf.Size(), Buf.Data());
+
+        Offsets.emplace_back(Offset);
+        Offset += Buf.Size();
+    }
+
+    bool THashTableBuilder::Place(
+        const std::vector<uint64_t>& hashes,
+        uint64_t bucketCount,
+        std::vector<uint32_t>& pilots,
+        std::vector<uint64_t>& slots
+    ) const {
+        const uint64_t n(hashes.size());
+        const uint64_t slotCount(slots.size());
+
+        // Group keys by bucket (counting sort)
+        std::vector<uint64_t> bucketStart(bucketCount + 1, 0);
+        std::vector<uint64_t> order(n);
+
+        for (const uint64_t hash : hashes) {
+            ++bucketStart[FastRange(hash, bucketCount) + 1];
+        }
+
+        uint64_t maxBucketSize(0);
+
+        for (uint64_t i = 1; i <= bucketCount; ++i) {
+            maxBucketSize = std::max(maxBucketSize, bucketStart[i]);
+            bucketStart[i] += bucketStart[i - 1];
+        }
+
+        {
+            std::vector<uint64_t> pos(bucketStart.begin(), bucketStart.end() - 1);
+
+            for (uint64_t i = 0; i < n; ++i) {
+                order[pos[FastRange(hashes[i], bucketCount)]++] = i;
+            }
+        }
+
+        // Largest buckets first, they are the hardest to place
+        std::vector<uint64_t> sizeStart(maxBucketSize + 2, 0);
+        std::vector<uint64_t> buckets(bucketCount);
+
+        for (uint64_t b = 0; b < bucketCount; ++b) {
+            ++sizeStart[maxBucketSize - (bucketStart[b + 1] - bucketStart[b]) + 1];
+        }
+
+        for (uint64_t i = 1; i < sizeStart.size(); ++i) {
+            sizeStart[i] += sizeStart[i - 1];
+        }
+
+        for (uint64_t b = 0; b < bucketCount; ++b) {
+            buckets[sizeStart[maxBucketSize - (bucketStart[b + 1] - bucketStart[b])]++] = b;
+        }
+
+        std::vector<uint64_t> taken((slotCount + 63) / 64, 0);
+        std::vector<uint64_t> candidate(maxBucketSize);
+
+        for (const uint64_t b : buckets) {
+            const uint64_t begin(bucketStart[b]);
+            const uint64_t size(bucketStart[b + 1] - begin);
+
+            if (size == 0) {
+                break;
+            }
+
+            uint64_t pilot(0);
+
+            for (; pilot < PILOT_MAX; ++pilot) {
+                bool ok(true);
+
+                for (uint64_t i = 0; ok && (i < size); ++i) {
+                    const uint64_t slot(SlotOf(hashes[order[begin + i]], pilot, slotCount));
+
+                    if (taken[slot / 64] & ((uint64_t)1 << (slot % 64))) {
+                        ok = false;
+                        break;
+                    }
+
+                    for (uint64_t j = 0; j < i; ++j) {
+                        if (candidate[j] == slot) {
+                            ok = false;
+                            break;
+                        }
+                    }
+
+                    candidate[i] = slot;
+                }
+
+                if (ok) {
+                    break;
+                }
+            }
+
+            if (pilot == PILOT_MAX) {
+                return false;
+            }
+
+            pilots[b] = pilot;
+
+            for (uint64_t i = 0; i < size; ++i) {
+                const uint64_t slot(candidate[i]);
+
+                taken[slot / 64] |= ((uint64_t)1 << (slot % 64));
+                slots[slot] = Offsets[order[begin + i]];
+            }
+        }
+
+        return true;
+    }
+
+    bool THashTableBuilder::Finish() {
+        if (!File) {
+            return false;
+        }
+
+        File.Remap();
+
+        const char* data(File.Data());
+        const uint64_t n(Offsets.size());
+
+        if ((n > 0) && !data) {
+            return false;
+        }
+
+        // ~4 keys per bucket, load factor ~0.97
+        const uint64_t bucketCount(n / 4 + 1);
+        const uint64_t slotCount(n + n / 32 + 1);
+        std::vector<uint64_t> hashes(n);
+        std::vector<uint32_t> pilots(bucketCount, 0);
+        std::vector<uint64_t> slots(slotCount, 0);
+        uint64_t seed(0);
+        bool placed(false);
+
+        for (; !placed && (seed < SEED_ATTEMPTS); ++seed) {
+            for (uint64_t i = 0; i < n; ++i) {
+                TBlob key;
+                TBlob value;
+                ReadRecord(data + Offsets[i], key, value);
+
+                hashes[i] = Hash64(key.Size(), key.Data(), seed);
+            }
+
+            std::fill(pilots.begin(), pilots.end(), 0);
+            std::fill(slots.begin(), slots.end(), 0);
+
+            placed = Place(hashes, bucketCount, pilots, slots);
+
+            if (!placed) {
+                // Either two keys share a full hash (try the next seed) or
+                // the keys are the same
+                std::vector<std::pair<uint64_t, uint64_t>> sorted;
+                sorted.reserve(n);
+
+                for (uint64_t i = 0; i < n; ++i) {
+                    sorted.emplace_back(hashes[i], Offsets[i]);
+                }
+
+                std::sort(sorted.begin(), sorted.end());
+
+                for (uint64_t i = 1; i < n; ++i) {
+                    if (sorted[i].first != sorted[i - 1].first) {
+                        continue;
+                    }
+
+                    TBlob a;
+                    TBlob b;
+                    TBlob value;
+                    ReadRecord(data + sorted[i].second, a, value);
+                    ReadRecord(data + sorted[i - 1].second, b, value);
+
+                    if (a.Cmp(b) == 0) {
+                        throw std::logic_error("Duplicate key in hash table");
+                    }
+                }
+            }
+        }
+
+        if (!placed) {
+            return false;
+        }
+
+        --seed;
+
+        const char zeros[8] = { 0 };
+        const uint64_t pilotsOffset(AlignUp(Offset, 8));
+
+        File.Append(pilotsOffset - Offset, zeros);
+
+        for (auto& pilot : pilots) {
+            pilot = hton(pilot);
+        }
+
+        File.Append(pilots.size() * sizeof(uint32_t), (const char*)pilots.data());
+        Offset = pilotsOffset + pilots.size() * sizeof(uint32_t);
+
+        const uint64_t slotsOffset(AlignUp(Offset, 8));
+
+        File.Append(slotsOffset - Offset, zeros);
+
+        for (auto& slot : slots) {
+            slot = hton(slot);
+        }
+
+        File.Append(slots.size() * sizeof(uint64_t), (const char*)slots.data());
+        Offset = slotsOffset + slots.size() * sizeof(uint64_t);
+
+        char header[HEADER_SIZE] = { 0 };
+        memcpy(header, MAGIC, 8);
+        Put<uint64_t>(header + HEADER_MODE, MODE_STATIC);
+        Put<uint64_t>(header + HEADER_SEED, seed);
+        Put<uint64_t>(header + HEADER_COUNT, n);
+        Put<uint64_t>(header + HEADER_A, bucketCount);
+        Put<uint64_t>(header + HEADER_B, slotCount);
+        Put<uint64_t>(header + HEADER_C, pilotsOffset);
+        Put<uint64_t>(header + HEADER_D, slotsOffset);
+
+        File.Write(0, HEADER_SIZE, header);
+
+        return (bool)File;
+    }
+
+    THashTable::THashTable(const size_t size, const char* data) {
+        if (CheckHeader(size, data, MODE_STATIC) || CheckHeader(size, data, MODE_MUTABLE)) {
+            Data = data;
+        }
+    }
+
+    uint64_t THashTable::Size() const {
+        return (Data ? Get<uint64_t>(Data + HEADER_COUNT) : 0);
+    }
+
+    bool THashTable::Find(const size_t keySize, const char* key, TBlob& value) const {
+        if (!Data) {
+            return false;
+        }
+
+        if (Get<uint64_t>(Data + HEADER_MODE) == MODE_STATIC) {
+            return FindStatic(Data, keySize, key, value);
+
+        } else {
+            return FindMutable(Data, keySize, key, value);
+        }
+    }
+
+    TMutableHashTable::TMutableHashTable(TFile& file, uint64_t capacity)
+        : File(file)
+    {
+        if (!File) {
+            return;
+        }
+
+        if (File.Size() == 0) {
+            // ACCESS_CREATE doesn't stat or map the file
+            File.Stat();
+
+            if (File.Size() > 0) {
+                File.Map();
+            }
+        }
+
+        if (File.Size() > 0) {
+            Ok = CheckHeader(File.Size(), File.Data(), MODE_MUTABLE);
+            return;
+        }
+
+        capacity = std::max(capacity, (uint64_t)16);
+
+        const uint64_t heapStart(HEADER_SIZE + capacity * MUTABLE_SLOT_SIZE);
+
+        File.Resize(heapStart + MUTABLE_HEAP_MIN);
+
+        if (!File || !File.Data()) {
+            return;
+        }
+
+        char* data(File.Data());
+
+        memset(data, 0, heapStart);
+        memcpy(data, MAGIC, 8);
+        Put<uint64_t>(data + HEADER_MODE, MODE_MUTABLE);
+        Put<uint64_t>(data + HEADER_A, capacity);
+        Put<uint64_t>(data + HEADER_B, heapStart);
+        Put<uint64_t>(data + HEADER_C, heapStart);
+
+        Ok = true;
+    }
+
+    uint64_t TMutableHashTable::Size() const {
+        return (Ok ? Get<uint64_t>(File.Data() + HEADER_COUNT) : 0);
+    }
+
+    bool TMutableHashTable::Find(const size_t keySize, const char* key, TBlob& value) const {
+        if (!Ok) {
+            return false;
+        }
+
+        return FindMutable(File.Data(), keySize, key, value);
+    }
+
+    bool TMutableHashTable::Reserve(uint64_t size) {
+        if (size <= File.Size()) {
+            return true;
+        }
+
+        File.Resize(std::max(size, (uint64_t)File.Size() * 2));
+
+        return (bool)File;
+    }
+
+    void TMutableHashTable::Compact() {
+        char* data(File.Data());
+        const uint64_t capacity(Get<uint64_t>(data + HEADER_A));
+        uint64_t heapEnd(Get<uint64_t>(data + HEADER_C));
+        std::vector<std::pair<uint64_t, uint64_t>> records;
+
+        records.reserve(Get<uint64_t>(data + HEADER_COUNT));
+
+        for (uint64_t i = 0; i < capacity; ++i) {
+            const uint64_t offset(Get<uint64_t>(data + HEADER_SIZE + i * MUTABLE_SLOT_SIZE + 8));
+
+            if (offset != 0) {
+                records.emplace_back(offset, i);
+            }
+        }
+
+        // In heap order, so every record moves down over dead space only
+        std::sort(records.begin(), records.end());
+
+        for (const auto& record : records) {
+            const uint64_t size(MutableRecordSize(data + record.first));
+
+            if (record.first != heapEnd) {
+                memmove(data + heapEnd, data + record.first, size);
+            }
+
+            Put<uint64_t>(data + HEADER_SIZE + record.second * MUTABLE_SLOT_SIZE + 8, heapEnd);
+            heapEnd += size;
+        }
+
+        Put<uint64_t>(data + HEADER_B, heapEnd);
+        Put<uint64_t>(data + HEADER_D, 0);
+    }
+
+    void TMutableHashTable::AddDead(uint64_t size) {
+        char* data(File.Data());
+        const uint64_t dead(Get<uint64_t>(data + HEADER_D) + size);
+
+        Put<uint64_t>(data + HEADER_D, dead);
+
+        if ((dead > MUTABLE_HEAP_MIN) && ((dead * 2) > (Get<uint64_t>(data + HEADER_B) - Get<uint64_t>(data + HEADER_C)))) {
+            Compact();
+        }
+    }
+
+    bool TMutableHashTable::Grow(uint64_t capacity) {
+        if (Get<uint64_t>(File.Data() + HEADER_D) > 0) {
+            // Dead records would be moved along with the live ones
+            Compact();
+        }
+
+        const char* data(File.Data());
+        const uint64_t oldCapacity(Get<uint64_t>(data + HEADER_A));
+        const uint64_t heapStart(Get<uint64_t>(data + HEADER_C));
+        const uint64_t heapEnd(Get<uint64_t>(data + HEADER_B));
+        const uint64_t delta((capacity - oldCapacity) * MUTABLE_SLOT_SIZE);
+        std::vector<std::pair<uint64_t, uint64_t>> entries;
+
+        entries.reserve(Get<uint64_t>(data + HEADER_COUNT));
+
+        for (uint64_t i = 0; i < oldCapacity; ++i) {
+            const char* slot(data + HEADER_SIZE + i * MUTABLE_SLOT_SIZE);
+            const uint64_t offset(Get<uint64_t>(slot + 8));
+
+            if (offset != 0) {
+                entries.emplace_back(Get<uint64_t>(slot), offset + delta);
+            }
+        }
+
+        if (!Reserve(heapEnd + delta)) {
+            return false;
+        }
+
+        char* out(File.Data());
+
+        memmove(out + heapStart + delta, out + heapStart, heapEnd - heapStart);
+        memset(out + HEADER_SIZE, 0, capacity * MUTABLE_SLOT_SIZE);
+
+        Put<uint64_t>(out + HEADER_A, capacity);
+        Put<uint64_t>(out + HEADER_B, heapEnd + delta);
+        Put<uint64_t>(out + HEADER_C, heapStart + delta);
+
+        for (const auto& entry : entries) {
+            uint64_t i(FastRange(entry.first, capacity));
+
+            while (Get<uint64_t>(out + HEADER_SIZE + i * MUTABLE_SLOT_SIZE + 8) != 0) {
+                if (++i == capacity) {
+                    i = 0;
+                }
+            }
+
+            Put<uint64_t>(out + HEADER_SIZE + i * MUTABLE_SLOT_SIZE, entry.first);
+            Put<uint64_t>(out + HEADER_SIZE + i * MUTABLE_SLOT_SIZE + 8, entry.second);
+        }
+
+        return true;
+    }
+
+    bool TMutableHashTable::Insert(const size_t keySize, const char* key, const size_t valueSize, const char* value) {
+        if (!Ok) {
+            return false;
+        }
+
+        {
+            const char* data(File.Data());
+            const uint64_t capacity(Get<uint64_t>(data + HEADER_A));
+
+            if ((Get<uint64_t>(data + HEADER_COUNT) + 1) * 4 > capacity * 3) {
+                if (!Grow(capacity * 2)) {
+                    Ok = false;
+                    return false;
+                }
+            }
+        }
+
+        const uint64_t hash(Hash64(keySize, key, Get<uint64_t>(File.Data() + HEADER_SEED)));
+        bool found;
+        const uint64_t i(ProbeMutable(File.Data(), hash, keySize, key, found));
+        const uint64_t slotOffset(HEADER_SIZE + i * MUTABLE_SLOT_SIZE);
+
+        char header[21];
+        size_t headerSize(1);
+        header[0] = RECORD_LIVE;
+        headerSize += PutVarint(header + headerSize, keySize);
+        headerSize += PutVarint(header + headerSize, valueSize);
+
+        const uint64_t recordSize(headerSize + keySize + valueSize);
+        uint64_t dead(0);
+
+        if (found) {
+            char* record(File.Data() + Get<uint64_t>(File.Data() + slotOffset + 8));
+            const uint64_t oldSize(MutableRecordSize(record));
+
+            if (recordSize <= oldSize) {
+                // Rewritten in place, the tail (if any) is dead space
+                memcpy(record, header, headerSize);
+                memcpy(record + headerSize, key, keySize);
+                memcpy(record + headerSize + keySize, value, valueSize);
+
+                if (recordSize < oldSize) {
+                    AddDead(oldSize - recordSize);
+                }
+
+                return true;
+            }
+
+            record[0] = RECORD_DEAD;
+            dead = oldSize;
+        }
+
+        const uint64_t heapEnd(Get<uint64_t>(File.Data() + HEADER_B));
+
+        if (!Reserve(heapEnd + recordSize)) {
+            Ok = false;
+            return false;
+        }
+
+        char* data(File.Data());
+
+        memcpy(data + heapEnd, header, headerSize);
+        memcpy(data + heapEnd + headerSize, key, keySize);
+        memcpy(data + heapEnd + headerSize + keySize, value, valueSize);
+
+        Put<uint64_t>(data + slotOffset, hash);
+        Put<uint64_t>(data + slotOffset + 8, heapEnd);
+        Put<uint64_t>(data + HEADER_B, heapEnd + recordSize);
+
+        if (!found) {
+            Put<uint64_t>(data + HEADER_COUNT, Get<uint64_t>(data + HEADER_COUNT) + 1);
+
+        } else {
+            AddDead(dead);
+        }
+
+        return true;
+    }
+
+    bool TMutableHashTable::Remove(const size_t keySize, const char* key) {
+        if (!Ok) {
+            return false;
+        }
+
+        char* data(File.Data());
+        const uint64_t hash(Hash64(keySize, key, Get<uint64_t>(data + HEADER_SEED)));
+        bool found;
+        uint64_t i(ProbeMutable(data, hash, keySize, key, found));
+
+        if (!found) {
+            return false;
+        }
+
+        const uint64_t capacity(Get<uint64_t>(data + HEADER_A));
+        auto slot = [data](uint64_t index) {
+            return data + HEADER_SIZE + index * MUTABLE_SLOT_SIZE;
+        };
+
+        const uint64_t offset(Get<uint64_t>(slot(i) + 8));
+        const uint64_t dead(MutableRecordSize(data + offset));
+
+        data[offset] = RECORD_DEAD;
+
+        // Backward shift deletion keeps probe chains intact without tombstones
+        uint64_t j(i);
+
+        while (true) {
+            if (++j == capacity) {
+                j = 0;
+            }
+
+            if (Get<uint64_t>(slot(j) + 8) == 0) {
+                break;
+            }
+
+            const uint64_t home(FastRange(Get<uint64_t>(slot(j)), capacity));
+            const bool movable((i <= j)
+                ? ((home <= i) || (home > j))
+                : ((home <= i) && (home > j))
+            );
+
+            if (movable) {
+                memcpy(slot(i), slot(j), MUTABLE_SLOT_SIZE);
+                i = j;
+            }
+        }
+
+        memset(slot(i), 0, MUTABLE_SLOT_SIZE);
+        Put<uint64_t>(data + HEADER_COUNT, Get<uint64_t>(data + HEADER_COUNT) - 1);
+        AddDead(dead);
+
+        return true;
+    }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "file.hpp"
+#include "str.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace NAC {
+    // Disk-resident hash table served from a TFile mapping.
+    //
+    // Static files are built once by THashTableBuilder and use a perfect
+    // hash (hash-and-displace: bucket -> pilot -> slot), so a lookup is a
+    // single slot probe. Updatable files are managed by TMutableHashTable
+    // and use linear probing over a slot array followed by a record heap.
+    // THashTable reads both.
+    class THashTableBuilder {
+    public:
+        THashTableBuilder() = delete;
+        THashTableBuilder(const THashTableBuilder&) = delete;
+        THashTableBuilder(THashTableBuilder&&) = default;
+
+        // file must be empty and created with ACCESS_CREATE; Finish() keeps
+        // about 40 bytes per key in memory while placing keys
+        THashTableBuilder(TFile& file);
+
+        void Add(const size_t keySize, const char* key, const size_t valueSize, const char* value);
+
+        void Add(const TBlob& key, const TBlob& value) {
+            Add(key.Size(), key.Data(), value.Size(), value.Data());
+        }
+
+        void Add(const std::string& key, const std::string& value) {
+            Add(key.size(), key.data(), value.size(), value.data());
+        }
+
+        // Throws std::logic_error on duplicate keys
+        bool Finish();
+
+    private:
+        bool Place(
+            const std::vector<uint64_t>& hashes,
+            uint64_t bucketCount,
+            std::vector<uint32_t>& pilots,
+            std::vector<uint64_t>& slots
+        ) const;
+
+    private:
+        TFile& File;
+        uint64_t Offset = 0;
+        TBlob Buf;
+        std::vector<uint64_t> Offsets;
+    };
+
+    class THashTable {
+    public:
+        THashTable(const size_t size, const char* data);
+
+        THashTable(const TFile& file)
+            : THashTable(file.Size(), file.Data())
+        {
+        }
+
+        explicit operator bool() const {
+            return (bool)Data;
+        }
+
+        uint64_t Size() const;
+
+        // Doesn't allocate, value points into the mapping
+        bool Find(const size_t keySize, const char* key, TBlob& value) const;
+
+        bool Find(const TBlob& key, TBlob& value) const {
+            return Find(key.Size(), key.Data(), value);
+        }
+
+        bool Find(const std::string& key, TBlob& value) const {
+            return Find(key.size(), key.data(), value);
+        }
+
+    private:
+        const char* Data = nullptr;
+    };
+
+    class TMutableHashTable {
+    public:
+        TMutableHashTable() = delete;
+        TMutableHashTable(const TMutableHashTable&) = delete;
+        TMutableHashTable(TMutableHashTable&&) = default;
+
+        // file must be opened read-write, an empty file gets initialized
+        TMutableHashTable(TFile& file, uint64_t capacity = 1024);
+
+        explicit operator bool() const {
+            return Ok && (bool)File;
+        }
+
+        uint64_t Size() const;
+
+        bool Find(const size_t keySize, const char* key, TBlob& value) const;
+
+        bool Find(const TBlob& key, TBlob& value) const {
+            return Find(key.Size(), key.Data(), value);
+        }
+
+        bool Find(const std::string& key, TBlob& value) const {
+            return Find(key.size(), key.data(), value);
+        }
+
+        // Inserts or replaces. May remap the file or move records, which
+        // invalidates views returned by Find(), so key and value must not
+        // point into it. A replacement that fits is written in place.
+        bool Insert(const size_t keySize, const char* key, const size_t valueSize, const char* value);
+
+        bool Insert(const TBlob& key, const TBlob& value) {
+            return Insert(key.Size(), key.Data(), value.Size(), value.Data());
+        }
+
+        bool Insert(const std::string& key, const std::string& value) {
+            return Insert(key.size(), key.data(), value.size(), value.data());
+        }
+
+        // Also invalidates views returned by Find()
+        bool Remove(const size_t keySize, const char* key);
+
+        bool Remove(const TBlob& key) {
+            return Remove(key.Size(), key.Data());
+        }
+
+        bool Remove(const std::string& key) {
+            return Remove(key.size(), key.data());
+        }
+
+    private:
+        bool Grow(uint64_t capacity);
+        bool Reserve(uint64_t size);
+        // Moves live records over the space of replaced and removed ones
+        void Compact();
+        // Compacts once dead records take more than half of the heap
+        void AddDead(uint64_t size);
+
+    private:
+        TFile& File;
+        bool Ok = false;
+    };
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+
+namespace NAC {
+    namespace NUtils {
+        struct TMPSCNode {
+            std::atomic<TMPSCNode*> Next{nullptr};
+        };
+
+        // Intrusive lock-free multi-producer single-consumer queue (Vyukov).
+        // Push() is wait-free, Pop() may only be called by one thread and
+        // returns nullptr while a concurrent Push() is half-done.
+        class TMPSCQueue {
+        public:
+            TMPSCQueue()
+                : Head(&Stub)
+                , Tail(&Stub)
+            {
+            }
+
+            TMPSCQueue(const TMPSCQueue&) = delete;
+            TMPSCQueue(TMPSCQueue&&) = delete;
+
+            void Push(TMPSCNode* node) {
+                node->Next.store(nullptr, std::memory_order_relaxed);
+
+                TMPSCNode* prev = Head.exchange(node, std::memory_order_acq_rel);
+                prev->Next.store(node, std::memory_order_release);
+            }
+
+            TMPSCNode* Pop() {
+                TMPSCNode* tail = Tail;
+                TMPSCNode* next = tail->Next.load(std::memory_order_acquire);
+
+                if (tail == &Stub) {
+                    if (!next) {
+                        return nullptr;
+                    }
+
+                    Tail = next;
+                    tail = next;
+                    next = next->Next.load(std::memory_order_acquire);
+                }
+
+                if (next) {
+                    Tail = next;
+                    return tail;
+                }
+
+                if (tail != Head.load(std::memory_order_acquire)) {
+                    return nullptr;
+                }
+
+                Push(&Stub);
+
+                next = tail->Next.load(std::memory_order_acquire);
+
+                if (next) {
+                    Tail = next;
+                    return tail;
+                }
+
+                return nullptr;
+            }
+
+        private:
+            std::atomic<TMPSCNode*> Head;
+            TMPSCNode* Tail;
+            TMPSCNode Stub;
+        };
+    }
+}
@@ -7,30 +7,119 @@
 #include <sys/socket.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <typeinfo>
+#include <stdexcept>
 
 #ifdef __linux__
+    #include "muhev_uring.hpp"
     #include <sys/epoll.h>
+    #include <sys/eventfd.h>
     #include <sys/ioctl.h>
     #include <utility>
 
-    struct epoll_event;
-
 #else
     #include <sys/event.h>
-
-    struct kevent;
 #endif
 
+#define MAX_COMPLETION_EVENTS 1024
+// Adaptive spinning stops once its window shrinks below this share of
+// the busy-poll budget
+#define BUSY_POLL_MIN_FRACTION 64
+// How often a loop with retired nodes left looks at them again when
+// nothing else wakes it
+#define RECLAIM_RETRY_MS 10
+
 namespace NAC {
     namespace NMuhEv {
+        namespace {
+            // Set while a thread holds the event buffer of a loop, i.e. is
+            // its main waiter (nested Wait() calls included)
+            static thread_local TLoop* Owning = nullptr;
+
+            struct TBusyGuard {
+                std::atomic<bool>* Flag = nullptr;
+                TLoop* PrevOwning = nullptr;
+
+                void Enter(std::atomic<bool>* flag, TLoop* loop) {
+                    Flag = flag;
+                    PrevOwning = Owning;
+                    Owning = loop;
+                }
+
+                ~TBusyGuard() {
+                    if (Flag) {
+                        Owning = PrevOwning;
+                        Flag->store(false, std::memory_order_release);
+                    }
+                }
+            };
+
+            static inline uint64_t MonotonicNs() {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+
+                return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+            }
+
+            // Set while a thread dispatches the events of a loop, changes
+            // made meanwhile go with its next kevent() or io_uring_enter()
+            static thread_local TLoop* Dispatching = nullptr;
+
+            struct TDispatchGuard {
+                TLoop* Prev;
+
+                TDispatchGuard(TLoop* loop)
+                    : Prev(Dispatching)
+                {
+                    Dispatching = loop;
+                }
+
+                ~TDispatchGuard() {
+                    Dispatching = Prev;
+                }
+            };
+
+            struct TRetiredNode : public NUtils::TMPSCNode {
+                TNode* Node;
+            };
+
+            // Counts a waiter in for the phase it started in, see Retire()
+            struct TReaderGuard {
+                std::atomic<size_t>* Readers = nullptr;
+
+                void Enter(std::atomic<size_t>* readers, const std::atomic<unsigned>& phase) {
+                    Readers = &readers[phase.load()];
+                    Readers->fetch_add(1);
+                }
+
+                ~TReaderGuard() {
+                    if (Readers) {
+                        Readers->fetch_sub(1);
+                    }
+                }
+            };
+
 #ifdef __linux__
-        using TInternalEvStruct = struct ::epoll_event;
+            static const unsigned URING_ENTRIES = 4096;
+
 #else
-        using TInternalEvStruct = struct ::kevent;
-#endif
 
-        namespace {
-#ifndef __linux__
+            static inline int KqueueAddFlags(const TNode& node, int filter) {
+                int flags = (EV_ADD | EV_ENABLE);
+
+                if ((node.GetEvFlags() & MUHEV_FLAG_EDGE) || (filter == EVFILT_USER)) {
+                    flags |= EV_CLEAR;
+                }
+
+                if (node.GetEvFlags() & MUHEV_FLAG_ONESHOT) {
+                    flags |= EV_ONESHOT;
+                }
+
+                return flags;
+            }
+
             static inline void AddEventKqueueImpl(int queueId, int filter, TNode& node) {
                 TInternalEvStruct event;
 
@@ -38,7 +127,7 @@ namespace NAC {
                     &event,
                     node.GetEvIdent(),
                     filter,
-                    EV_ADD | EV_ENABLE,
+                    KqueueAddFlags(node, filter),
                     0,
                     0,
                     0
@@ -82,7 +171,7 @@ namespace NAC {
                     0,
                     nullptr
                 ) != 0) {
-                    if (errno == ENOENT) {
+                    if ((errno == ENOENT) || (errno == EBADF)) {
                         return;
                     }
 
@@ -96,47 +185,380 @@ namespace NAC {
         }
 
         void TLoop::MakeFds(int* out) {
-            if (socketpair(PF_LOCAL, SOCK_STREAM, 0, out) == -1) {
-                perror("socketpair");
+#ifdef __linux__
+            out[0] = out[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+            if (out[0] == -1) {
+                perror("eventfd");
                 abort();
             }
+
+#else
+            static std::atomic<int> lastIdent(0);
+
+            out[0] = QueueId;
+            out[1] = ++lastIdent;
+#endif
         }
 
         TTriggerNodeBase::~TTriggerNodeBase() {
+#ifdef __linux__
             close(EvIdent);
-            close(TriggerFd_);
+
+#else
+            RemoveEventKqueueImpl(TriggerFd_, EVFILT_USER, EvIdent);
+#endif
         }
 
-        TLoop::TLoop() {
+        void TTriggerNodeBase::TriggerImpl() const {
 #ifdef __linux__
-            QueueId = epoll_create(0x1);
+            TriggerFd(TriggerFd_);
+
 #else
-            QueueId = kqueue();
+            TInternalEvStruct event;
+
+            EV_SET(
+                &event,
+                EvIdent,
+                EVFILT_USER,
+                0,
+                NOTE_TRIGGER,
+                0,
+                0
+            );
+
+            while (kevent(
+                TriggerFd_,
+                &event,
+                1,
+                nullptr,
+                0,
+                nullptr
+            ) != 0) {
+                if (errno != EINTR) {
+                    perror("kevent");
+                    abort();
+                }
+            }
 #endif
+        }
+
+        void TTriggerNodeBase::Drain() {
+#ifdef __linux__
+            uint64_t value;
+
+            if ((read(EvIdent, &value, sizeof(value)) == -1) && (errno != EAGAIN) && (errno != EINTR)) {
+                perror("read");
+                abort();
+            }
+#endif
+
+            // Cleared last: a Trigger() racing with the drain above is
+            // handled by the callback that follows, clearing first would
+            // let the drain eat its write and leave Pending set for good
+            Pending.store(false, std::memory_order_release);
+        }
+
+        TLoop::TLoop(int backend) {
+#ifdef __linux__
+            QueueId = -1;
+
+            if (backend == MUHEV_BACKEND_URING) {
+                Uring.reset(new TUring);
+
+                if (!Uring->Init(URING_ENTRIES)) {
+                    Uring.reset();
+                }
+            }
+
+            if (!Uring) {
+                QueueId = epoll_create(0x1);
+
+                if (QueueId == -1) {
+                    perror("epoll_create");
+                    abort();
+                }
+            }
+
+#else
+            (void)backend;
+            QueueId = kqueue();
 
             if (QueueId == -1) {
                 perror("kqueue");
                 abort();
             }
+#endif
 
-            WakeupNode = NewTrigger([](){});
+            WakeupNode = NewTrigger([this]() {
+                // Other waiters leave them to the main one, so triggers
+                // destroyed on its thread can't be running elsewhere
+                if (Owning == this) {
+                    LightTriggers.Run();
+                }
+            });
         }
 
         TLoop::~TLoop() {
+            while (Tracked.Head) {
+                Untrack(*Tracked.Head);
+            }
+
+            for (auto& list : ReadyLists) {
+                while (list.Head) {
+                    Unready(*list.Head);
+                }
+            }
+
             RemoveEvent(*WakeupNode);
+            WakeupNode.reset();
+
+            while (auto task = (TPostedTask*)Posted.Pop()) {
+                delete task;
+            }
+
+            while (auto retired = (TRetiredNode*)Retired.Pop()) {
+                Grace[0].push_back(retired->Node);
+                delete retired;
+            }
+
+            for (auto& nodes : Grace) {
+                for (TNode* node : nodes) {
+                    RemoveEvent(*node);
+                    delete node;
+                }
+            }
 
-            if (close(QueueId) == -1) {
+            if ((QueueId != -1) && (close(QueueId) == -1)) {
                 perror("close");
             }
         }
 
+        int TLoop::GetBackend() const {
+#ifdef __linux__
+            if (Uring) {
+                return MUHEV_BACKEND_URING;
+            }
+#endif
+
+            return MUHEV_BACKEND_DEFAULT;
+        }
+
+        void TLoop::Track(TNode& node) {
+            Track(node, Tracked);
+        }
+
+        void TLoop::Track(TNode& node, NLoopPrivate::TTrackList& list) {
+            if (node.TrackList == &list) {
+                return;
+            }
+
+            if (node.Tracker) {
+                node.Tracker->Untrack(node);
+            }
+
+            node.Tracker = this;
+            node.TrackList = &list;
+            node.TrackPrev = nullptr;
+            node.TrackNext = list.Head;
+
+            if (list.Head) {
+                list.Head->TrackPrev = &node;
+            }
+
+            list.Head = &node;
+            ++list.Count;
+        }
+
+        void TLoop::Untrack(TNode& node) {
+            if (node.Tracker != this) {
+                return;
+            }
+
+            NLoopPrivate::TTrackList& list = *node.TrackList;
+
+            if (node.TrackPrev) {
+                node.TrackPrev->TrackNext = node.TrackNext;
+
+            } else {
+                list.Head = node.TrackNext;
+            }
+
+            if (node.TrackNext) {
+                node.TrackNext->TrackPrev = node.TrackPrev;
+            }
+
+            node.Tracker = nullptr;
+            node.TrackList = nullptr;
+            node.TrackPrev = nullptr;
+            node.TrackNext = nullptr;
+            --list.Count;
+        }
+
+        bool TLoop::WaitUntilComplete() {
+            return WaitUntilComplete(Tracked);
+        }
+
+        bool TLoop::WaitUntilComplete(NLoopPrivate::TTrackList& list) {
+            while (list.Count > 0) {
+                if (!Wait(std::min<size_t>(list.Count, MAX_COMPLETION_EVENTS))) {
+                    return false;
+                }
+
+                UntrackDead(list);
+            }
+
+            return true;
+        }
+
+        void TLoop::UntrackDead(NLoopPrivate::TTrackList& list) {
+            // IsAlive() may have turned false outside of the node's Cb(),
+            // e.g. in another node's one. Stopping at the first live node
+            // is enough to tell when all of them are done, without walking
+            // the whole list every round.
+            while (list.Head && !list.Head->IsAlive()) {
+                Untrack(*list.Head);
+            }
+        }
+
+        TLightTrigger::TLightTrigger(TLoop& loop)
+            : Loop(loop)
+            , Index(loop.LightTriggers.Register(this))
+        {
+        }
+
+        TLightTrigger::~TLightTrigger() {
+            Detach();
+        }
+
+        void TLightTrigger::Detach() {
+            if (!Detached) {
+                Detached = true;
+                Loop.LightTriggers.Release(Index);
+            }
+        }
+
+        void TLightTrigger::Trigger() const {
+            if (Loop.LightTriggers.Fire(Index)) {
+                Loop.Wake();
+            }
+        }
+
         void TLoop::Wake() {
             WakeupNode->Trigger();
         }
 
+        void TLoop::PostImpl(TPostedTask* task) {
+            Posted.Push(task);
+            WakeupNode->Trigger();
+        }
+
+        void TLoop::RunPosted() {
+            // Tasks posted by the tasks themselves wait for the next round
+            size_t left = PostedCount_.load(std::memory_order_acquire);
+
+            while (left > 0) {
+                auto task = (TPostedTask*)Posted.Pop();
+
+                if (!task) {
+                    // A producer is between Push() and Trigger(), it will
+                    // wake the loop again
+                    break;
+                }
+
+                --left;
+
+#ifdef AC_MUHEV_STATS
+                const uint64_t start = TLoopStats::Now();
+#endif
+
+                try {
+                    task->Run();
+
+                } catch (...) {
+                }
+
+#ifdef AC_MUHEV_STATS
+                Stats.RecordCallback(typeid(*task), TLoopStats::Now() - start);
+#endif
+
+                delete task;
+                PostedCount_.fetch_sub(1, std::memory_order_release);
+            }
+
+            if (left > 0) {
+                WakeupNode->Trigger();
+            }
+        }
+
+        void TLoop::Retire(TNode* node) {
+            auto retired = new TRetiredNode;
+            retired->Node = node;
+
+            RetiredCount.fetch_add(1);
+            Retired.Push(retired);
+            WakeupNode->Trigger();
+        }
+
+        void TLoop::Reclaim() {
+            if (
+                (RetiredCount.load(std::memory_order_acquire) == 0)
+                && Grace[0].empty()
+                && Grace[1].empty()
+            ) {
+                return;
+            }
+
+            const unsigned phase = Phase.load();
+            size_t left = RetiredCount.load(std::memory_order_acquire);
+
+            // Unregistered first: waiters that poll from now on can't get
+            // these nodes, the ones already polling are counted in Readers
+            while (left > 0) {
+                auto retired = (TRetiredNode*)Retired.Pop();
+
+                if (!retired) {
+                    break;
+                }
+
+                --left;
+                RemoveEvent(*retired->Node);
+                Grace[phase].push_back(retired->Node);
+                delete retired;
+                RetiredCount.fetch_sub(1, std::memory_order_release);
+            }
+
+            // Every waiter of the previous phase has to leave before the
+            // nodes retired in it go, and before the phase is reused; the
+            // ones sleeping in the kernel are woken to start over
+            if (Readers[phase ^ 1].load() > 0) {
+                WakeupNode->Trigger();
+                return;
+            }
+
+            std::vector<TNode*> nodes;
+            nodes.swap(Grace[phase ^ 1]);
+
+            if (!Grace[phase].empty()) {
+                Phase.store(phase ^ 1);
+
+                // Single waiter loops get here with nobody else polling
+                if (Readers[phase].load() == 0) {
+                    nodes.insert(nodes.end(), Grace[phase].begin(), Grace[phase].end());
+                    Grace[phase].clear();
+                }
+            }
+
+            for (TNode* node : nodes) {
+                delete node;
+            }
+        }
+
         void TriggerFd(int fd) {
+            const uint64_t value(1);
+
             while (true) {
-                int rv = write(fd, "1", 1);
+                int rv = write(fd, &value, sizeof(value));
 
                 if (rv > 0) {
                     break;
@@ -155,20 +577,67 @@ namespace NAC {
             }
         }
 
-        void TLoop::AddEvent(TNode& node, bool mod) {
+        void TLoop::AddEvent(TNode& node, bool) {
+            if (
+                (node.RegLoop == this)
+                && (node.RegIdent == node.GetEvIdent())
+                && (node.RegFilter == node.GetEvFilter())
+                && (node.RegFlags == node.GetEvFlags())
+                // Re-arming a one-shot node is never a no-op
+                && !(node.GetEvFlags() & MUHEV_FLAG_ONESHOT)
+            ) {
+                return;
+            }
+
+            if (
+                // The node watches another fd now
+                ((node.RegLoop == this) && (node.RegIdent != node.GetEvIdent()))
+                // io_uring polls are per node, the old loop's would outlive it
+                || (node.RegLoop && (node.RegLoop != this) && (node.RegSlot >= 0))
+            ) {
+                node.RegLoop->RemoveEvent(node);
+            }
+
 #ifdef __linux__
+            if (Uring) {
+                node.RegSlot = Uring->Arm(node, ((node.RegLoop == this) ? node.RegSlot : -1));
+
+                if (Dispatching != this) {
+                    Uring->Submit();
+                }
+
+                node.RegLoop = this;
+                node.RegIdent = node.GetEvIdent();
+                node.RegFilter = node.GetEvFilter();
+                node.RegFlags = node.GetEvFlags();
+
+                return;
+            }
+
             TInternalEvStruct event = { 0 };
             event.events = 0;
             event.data.ptr = (void*)&node;
 
             if (node.GetEvFilter() & MUHEV_FILTER_READ) {
-                event.events |= EPOLLIN;
+                event.events |= (EPOLLIN | EPOLLRDHUP);
             }
 
             if (node.GetEvFilter() & MUHEV_FILTER_WRITE) {
                 event.events |= EPOLLOUT;
             }
 
+            if (node.GetEvFlags() & MUHEV_FLAG_EDGE) {
+                event.events |= EPOLLET;
+            }
+
+            if (node.GetEvFlags() & MUHEV_FLAG_ONESHOT) {
+                event.events |= EPOLLONESHOT;
+            }
+
+            // Still retried the other way: the fd may have been closed
+            // and reused, or registered through another node
+            const bool mod = (node.RegLoop == this);
+
             if (
                 (epoll_ctl(QueueId, (mod ? EPOLL_CTL_MOD : EPOLL_CTL_ADD), node.GetEvIdent(), &event) != 0)
                 && (
@@ -184,46 +653,279 @@ namespace NAC {
             }
 
 #else
-            if (node.GetEvFilter() & MUHEV_FILTER_READ) {
-                AddEventKqueueImpl(QueueId, EVFILT_READ, node);
+            if (node.GetEvFilter() & MUHEV_FILTER_USER) {
+                AddEventKqueueImpl(QueueId, EVFILT_USER, node);
 
             } else {
-                RemoveEventKqueueImpl(QueueId, EVFILT_READ, node.GetEvIdent());
+                const int registered = ((node.RegLoop == this) ? node.RegFilter : MUHEV_FILTER_NONE);
+                const bool rearm = (
+                    (node.RegLoop != this)
+                    || (node.RegFlags != node.GetEvFlags())
+                    || (node.GetEvFlags() & MUHEV_FLAG_ONESHOT)
+                );
+
+                static const int filters[][2] = {
+                    { MUHEV_FILTER_READ, EVFILT_READ },
+                    { MUHEV_FILTER_WRITE, EVFILT_WRITE },
+                };
+
+                for (const auto& filter : filters) {
+                    if (node.GetEvFilter() & filter[0]) {
+                        if (rearm || !(registered & filter[0])) {
+                            Change(node.GetEvIdent(), filter[1], KqueueAddFlags(node, filter[1]), &node);
+                        }
+
+                    } else if (registered & filter[0]) {
+                        Change(node.GetEvIdent(), filter[1], EV_DELETE, nullptr);
+                    }
+                }
             }
+#endif
 
-            if (node.GetEvFilter() & MUHEV_FILTER_WRITE) {
-                AddEventKqueueImpl(QueueId, EVFILT_WRITE, node);
+            node.RegLoop = this;
+            node.RegIdent = node.GetEvIdent();
+            node.RegFilter = node.GetEvFilter();
+            node.RegFlags = node.GetEvFlags();
+        }
 
-            } else {
-                RemoveEventKqueueImpl(QueueId, EVFILT_WRITE, node.GetEvIdent());
+#ifndef __linux__
+        void TLoop::Change(int ident, int filter, int flags, TNode* node) {
+            TInternalEvStruct event;
+
+            EV_SET(
+                &event,
+                ident,
+                filter,
+                flags,
+                0,
+                0,
+                0
+            );
+
+            event.udata = (void*)node;
+
+            if (Dispatching == this) {
+                NUtils::TSpinLockGuard guard(ChangesLock);
+                Changes.push_back(event);
+                return;
             }
+
+            while (kevent(
+                QueueId,
+                &event,
+                1,
+                nullptr,
+                0,
+                nullptr
+            ) != 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                if ((flags & EV_DELETE) && ((errno == ENOENT) || (errno == EBADF))) {
+                    return;
+                }
+
+                perror("kevent");
+                abort();
+            }
+        }
+
+        void TLoop::DropChanges(TNode& node) {
+            NUtils::TSpinLockGuard guard(ChangesLock);
+
+            Changes.erase(std::remove_if(Changes.begin(), Changes.end(), [&node](const TInternalEvStruct& event) {
+                return (event.udata == (void*)&node);
+            }), Changes.end());
+        }
 #endif
+
+        bool TLoop::IsLoopThread() const {
+            return (Owning == this);
         }
 
-        bool TLoop::Wait(const size_t capacity) {
-            TInternalEvStruct list[capacity];
+        void TLoop::SetBusyPoll(uint64_t budgetUs) {
+            BusyPollNs = budgetUs * 1000;
+            SpinNs = BusyPollNs;
+        }
 
-            while (true) {
+        int TLoop::Poll(TInternalEvStruct* list, size_t changes, size_t capacity, int64_t timeoutMs) {
 #ifdef __linux__
-                // NUtils::cluck(1, "wait()");
-                int triggeredCount = epoll_wait(
-                    QueueId,
-                    list,
-                    capacity,
-                    24 * 60 * 60
-                );
+            (void)changes;
+
+            if (Uring) {
+                return Uring->Wait(list, capacity, timeoutMs);
+            }
+
+            return epoll_wait(QueueId, list, capacity, timeoutMs);
 
 #else
-                int triggeredCount = kevent(
-                    QueueId,
-                    nullptr,
-                    0,
-                    list,
-                    capacity,
-                    nullptr
-                );
+            struct timespec ts;
+            ts.tv_sec = timeoutMs / 1000;
+            ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+
+            return kevent(
+                QueueId,
+                list,
+                changes,
+                list,
+                capacity + changes,
+                ((timeoutMs >= 0) ? &ts : nullptr)
+            );
+#endif
+        }
+
+        int TLoop::Spin(TInternalEvStruct* list, size_t changes, size_t capacity, int64_t timeoutMs) {
+            uint64_t window = SpinNs;
+
+            if ((timeoutMs >= 0) && ((uint64_t)timeoutMs * 1000000 < window)) {
+                window = (uint64_t)timeoutMs * 1000000;
+            }
+
+            const uint64_t deadline = MonotonicNs() + window;
+            int rv = 0;
+
+            do {
+                rv = Poll(list, changes, capacity, 0);
+                changes = 0;
+
+            } while ((rv == 0) && (MonotonicNs() < deadline));
+
+            if (rv > 0) {
+                SpinNs = std::min(SpinNs * 2, BusyPollNs);
+
+            } else if (rv == 0) {
+                // Idle: spin less next time, and not at all once the
+                // window gets too small to matter
+                SpinNs /= 2;
+
+                if (SpinNs < BusyPollNs / BUSY_POLL_MIN_FRACTION) {
+                    SpinNs = 0;
+                }
+            }
+
+            return rv;
+        }
+
+        bool TLoop::Wait(const size_t capacity) {
+            // The buffer is kept between calls and only ever grows; nested
+            // Wait() calls and other threads waiting on a one-shot loop
+            // get a temporary one
+            std::vector<TInternalEvStruct> tmp;
+            std::vector<TInternalEvStruct>* events = &tmp;
+            TBusyGuard guard;
+
+            if (!EventsBusy.exchange(true, std::memory_order_acquire)) {
+                events = &Events;
+                guard.Enter(&EventsBusy, this);
+            }
+
+            if (events->size() < capacity) {
+                events->resize(capacity);
+            }
+
+            TInternalEvStruct* list = events->data();
+
+            while (true) {
+                // The thread owning Events is the one freeing retired nodes
+                // (after this round), only the others need to be waited for
+                TReaderGuard reader;
+
+                if (events != &Events) {
+                    reader.Enter(Readers, Phase);
+                }
+
+                // Timers are only touched by the thread owning Events, the
+                // wheel isn't thread-safe
+                int64_t timeout = ((events == &Events) ? Timers.NextTimeout() : -1);
+
+                if ((timeout < 0) || (timeout > 24 * 60 * 60)) {
+                    timeout = 24 * 60 * 60;
+                }
+
+#ifndef __linux__
+                if ((events != &Events) || (Timers.Size() == 0)) {
+                    timeout = -1;
+                }
 #endif
 
+                // Carried over readiness and deferred tasks are run right
+                // after collecting what is new
+                if ((events == &Events) && HasReady()) {
+                    timeout = 0;
+                }
+
+                if (events == &Events) {
+                    // Other waiters pass on the wakeups of Retire() and
+                    // Post() calls while this is set, but may still hold on
+                    // to retired nodes: check back on them
+                    OwnerPolling.store(true);
+
+                    // Posted or fired before it was set, the wakeup may have
+                    // gone to another waiter
+                    if ((PostedCount_.load() > 0) || LightTriggers.HasFired()) {
+                        timeout = 0;
+                    }
+
+                    if (
+                        ((timeout < 0) || (timeout > RECLAIM_RETRY_MS))
+                        && ((RetiredCount.load() > 0) || !Grace[0].empty() || !Grace[1].empty())
+                    ) {
+                        timeout = RECLAIM_RETRY_MS;
+                    }
+                }
+
+#ifdef AC_MUHEV_STATS
+                const uint64_t waitStart = TLoopStats::Now();
+#endif
+
+                size_t changes = 0;
+
+#ifndef __linux__
+                {
+                    NUtils::TSpinLockGuard guard(ChangesLock);
+                    changes = Changes.size();
+
+                    // kevent() may share one array between the changelist
+                    // and the eventlist; the extra room takes change errors
+                    if (events->size() < (capacity + changes)) {
+                        events->resize(capacity + changes);
+                        list = events->data();
+                    }
+
+                    std::copy(Changes.begin(), Changes.end(), list);
+                    Changes.clear();
+                }
+#endif
+
+                int triggeredCount = 0;
+
+                if ((SpinNs > 0) && (timeout != 0)) {
+                    const uint64_t spinStart = MonotonicNs();
+
+                    triggeredCount = Spin(list, changes, capacity, timeout);
+                    changes = 0;
+
+                    if ((triggeredCount == 0) && (timeout > 0)) {
+                        timeout = std::max<int64_t>(timeout - (int64_t)((MonotonicNs() - spinStart) / 1000000), 0);
+                    }
+                }
+
+                if (triggeredCount == 0) {
+                    const uint64_t sleepStart = ((BusyPollNs > 0) ? MonotonicNs() : 0);
+
+                    triggeredCount = Poll(list, changes, capacity, timeout);
+
+                    // Woken soon enough for spinning to have caught it
+                    if ((BusyPollNs > 0) && (triggeredCount > 0) && ((MonotonicNs() - sleepStart) < BusyPollNs)) {
+                        SpinNs = std::min(std::max(SpinNs * 2, BusyPollNs / 8), BusyPollNs);
+                    }
+                }
+
+                if (events == &Events) {
+                    OwnerPolling.store(false, std::memory_order_relaxed);
+                }
+
                 if (triggeredCount < 0) {
                     if (errno == EINTR) {
                         continue;
@@ -232,7 +934,17 @@ namespace NAC {
                     return false;
 
                 } else {
-                    for (size_t i = 0; i < triggeredCount; ++i) {
+#ifdef AC_MUHEV_STATS
+                    Stats.RecordWait(TLoopStats::Now() - waitStart, triggeredCount);
+#endif
+
+                    // Only the thread owning the main buffer schedules, the
+                    // others (nested or one-shot waiters) run what they get
+                    const bool schedule = (events == &Events);
+
+                    TDispatchGuard dispatching(this);
+
+                    for (int i = 0; i < triggeredCount; ++i) {
                         const auto& event = list[i];
                         int filter = MUHEV_FILTER_NONE;
                         int flags = MUHEV_FLAG_NONE;
@@ -241,6 +953,11 @@ namespace NAC {
                         auto node = (TNode*)event.data.ptr;
 #else
                         auto node = (TNode*)event.udata;
+
+                        // A failed EV_DELETE from the changelist
+                        if (!node) {
+                            continue;
+                        }
 #endif
 
 #ifdef __linux__
@@ -252,6 +969,21 @@ namespace NAC {
                             filter |= MUHEV_FILTER_WRITE;
                         }
 
+                        if (event.events & (EPOLLRDHUP | EPOLLHUP)) {
+                            flags |= MUHEV_FLAG_EOF;
+                        }
+
+                        if (event.events & EPOLLERR) {
+                            flags |= MUHEV_FLAG_ERROR;
+                        }
+
+                        // Hang-ups and errors come without IN/OUT, report them
+                        // on the registered filters so the next read/write
+                        // picks up the condition
+                        if (event.events & (EPOLLHUP | EPOLLERR)) {
+                            filter |= (node->GetEvFilter() & (MUHEV_FILTER_READ | MUHEV_FILTER_WRITE));
+                        }
+
 #else
                         switch (event.filter) {
                             case EVFILT_READ:
@@ -262,44 +994,338 @@ namespace NAC {
                                 filter = MUHEV_FILTER_WRITE;
                                 break;
 
+                            case EVFILT_USER:
+                                filter = MUHEV_FILTER_USER;
+                                break;
+
                             default:
                                 break;
                         }
-#endif
 
-                        if (node->IsAlive()) {
-                            try {
-                                node->Cb(filter, flags);
+                        if (event.flags & EV_EOF) {
+                            flags |= MUHEV_FLAG_EOF;
 
-                            } catch (...) {
+                            // fflags holds the pending socket error, if any
+                            if (event.fflags != 0) {
+                                flags |= MUHEV_FLAG_ERROR;
                             }
                         }
+
+                        if (event.flags & EV_ERROR) {
+                            flags |= MUHEV_FLAG_ERROR;
+                        }
+#endif
+
+                        if (schedule) {
+                            Ready(*node, filter, flags);
+
+                        } else {
+                            Dispatch(*node, filter, flags);
+                        }
                     }
 
+                    if (schedule) {
+                        DispatchReady();
+                        RunDeferred();
+                        // Posted is single-consumer: the other waiters leave
+                        // the tasks to this thread
+                        RunPosted();
+
+#ifdef AC_MUHEV_STATS
+                        const uint64_t timersStart = TLoopStats::Now();
+
+                        if (Timers.Advance() > 0) {
+                            Stats.RecordCallback(typeid(TTimerWheel), TLoopStats::Now() - timersStart);
+                        }
+
+#else
+                        Timers.Advance();
+#endif
+                    }
+
+                    break;
+                }
+            }
+
+            if (events == &Events) {
+                Reclaim();
+
+            } else if (
+                ((RetiredCount.load() > 0) || (PostedCount_.load() > 0) || LightTriggers.HasFired())
+                && OwnerPolling.load()
+            ) {
+                // The wakeup for them may have been taken here
+                WakeupNode->Trigger();
+            }
+
+            return true;
+        }
+
+        void TLoop::Ready(TNode& node, int filter, int flags) {
+            if (node.ReadyLoop == this) {
+                node.ReadyFilter |= filter;
+                node.ReadyFlags |= flags;
+                return;
+            }
+
+            TReadyList& list = ReadyLists[node.Priority];
+
+            node.ReadyLoop = this;
+            node.ReadyFilter = filter;
+            node.ReadyFlags = flags;
+            node.ReadyPrev = list.Tail;
+            node.ReadyNext = nullptr;
+
+            if (list.Tail) {
+                list.Tail->ReadyNext = &node;
+
+            } else {
+                list.Head = &node;
+            }
+
+            list.Tail = &node;
+            ++list.Size;
+        }
+
+        void TLoop::Unready(TNode& node) {
+            if (node.ReadyLoop != this) {
+                return;
+            }
+
+            TReadyList& list = ReadyLists[node.Priority];
+
+            if (node.ReadyPrev) {
+                node.ReadyPrev->ReadyNext = node.ReadyNext;
+
+            } else {
+                list.Head = node.ReadyNext;
+            }
+
+            if (node.ReadyNext) {
+                node.ReadyNext->ReadyPrev = node.ReadyPrev;
+
+            } else {
+                list.Tail = node.ReadyPrev;
+            }
+
+            node.ReadyLoop = nullptr;
+            node.ReadyPrev = nullptr;
+            node.ReadyNext = nullptr;
+            --list.Size;
+        }
+
+        bool TLoop::HasReady() const {
+            for (const auto& list : ReadyLists) {
+                if (list.Head) {
                     return true;
                 }
             }
+
+            return !Deferred.empty();
+        }
+
+        void TLoop::Dispatch(TNode& node, int filter, int flags) {
+            if (!node.IsAlive()) {
+                return;
+            }
+
+            // Untracked nodes may delete themselves in Cb()
+            const bool tracked = (node.Tracker == this);
+
+#ifdef AC_MUHEV_STATS
+            // Taken before Cb() in case the node deletes itself
+            const std::type_info& type = typeid(node);
+            const uint64_t start = TLoopStats::Now();
+#endif
+
+            try {
+                node.Cb(filter, flags);
+
+            } catch (...) {
+            }
+
+#ifdef AC_MUHEV_STATS
+            Stats.RecordCallback(type, TLoopStats::Now() - start);
+#endif
+
+            if (tracked && !node.IsAlive()) {
+                Untrack(node);
+            }
+        }
+
+        void TLoop::DispatchReady() {
+            const uint64_t deadline = ((DispatchBudgetNs > 0) ? (MonotonicNs() + DispatchBudgetNs) : 0);
+
+            for (auto& list : ReadyLists) {
+                // Nodes queued again by the callbacks wait for the next round
+                size_t left = list.Size;
+
+                while ((left > 0) && list.Head) {
+                    TNode& node = *list.Head;
+                    const int filter = node.ReadyFilter;
+                    const int flags = node.ReadyFlags;
+
+                    --left;
+                    Unready(node);
+                    Dispatch(node, filter, flags);
+
+                    if ((deadline > 0) && (MonotonicNs() >= deadline)) {
+                        return;
+                    }
+                }
+            }
+        }
+
+        void TLoop::RunDeferred() {
+            if (Deferred.empty()) {
+                return;
+            }
+
+            // Tasks deferred by the tasks themselves wait for the next round
+            std::vector<std::unique_ptr<TPostedTask>> tasks;
+            tasks.swap(Deferred);
+
+            for (auto& task : tasks) {
+#ifdef AC_MUHEV_STATS
+                const uint64_t start = TLoopStats::Now();
+#endif
+
+                try {
+                    task->Run();
+
+                } catch (...) {
+                }
+
+#ifdef AC_MUHEV_STATS
+                Stats.RecordCallback(typeid(*task), TLoopStats::Now() - start);
+#endif
+            }
+
+            if (Deferred.empty()) {
+                // Keeps the buffer
+                tasks.clear();
+                Deferred.swap(tasks);
+            }
         }
 
         void TLoop::RemoveEvent(TNode& node) {
+            // Readiness collected earlier is stale now
+            Unready(node);
+
+            if (!node.RegLoop) {
+                return;
+            }
+
+            // Otherwise the node has moved to another loop since, or the
+            // fd is removed through another node: the cache says nothing
+            // about this loop, so everything the fd may have here goes
+            const bool own = (node.RegLoop == this);
+            const int ident = (own ? node.RegIdent : node.GetEvIdent());
+            const int filter = (own ? node.RegFilter : (MUHEV_FILTER_READ | MUHEV_FILTER_WRITE));
+
+            if (own) {
+                node.RegLoop = nullptr;
+                node.RegIdent = -1;
+                node.RegFilter = MUHEV_FILTER_NONE;
+                node.RegFlags = MUHEV_FLAG_NONE;
+            }
 
 #ifdef __linux__
+            (void)filter;
+
+            if (Uring) {
+                // Polls are per node, another node's can't be found by fd
+                if (own) {
+                    Uring->Disarm(node.RegSlot);
+                    node.RegSlot = -1;
+
+                    if (Dispatching != this) {
+                        Uring->Submit();
+                    }
+                }
+
+                return;
+            }
+
             TInternalEvStruct event = { 0 };
 
+            // The fd may have been closed already, which unregisters it
             if (
-                (epoll_ctl(QueueId, EPOLL_CTL_DEL, node.GetEvIdent(), &event) != 0)
+                (epoll_ctl(QueueId, EPOLL_CTL_DEL, ident, &event) != 0)
                 && (errno != ENOENT)
+                && (errno != EBADF)
             ) {
                 perror("epoll_ctl");
                 abort();
             }
 
 #else
-            RemoveEventKqueueImpl(QueueId, EVFILT_READ, node.GetEvIdent());
-            RemoveEventKqueueImpl(QueueId, EVFILT_WRITE, node.GetEvIdent());
+            if (own && (filter & MUHEV_FILTER_USER)) {
+                RemoveEventKqueueImpl(QueueId, EVFILT_USER, ident);
+                return;
+            }
+
+            // Queued additions would refer to a node about to go away
+            DropChanges(node);
+
+            if (filter & MUHEV_FILTER_READ) {
+                Change(ident, EVFILT_READ, EV_DELETE, nullptr);
+            }
+
+            if (filter & MUHEV_FILTER_WRITE) {
+                Change(ident, EVFILT_WRITE, EV_DELETE, nullptr);
+            }
 #endif
         }
 
+        TNode::~TNode() {
+            if (Tracker) {
+                Tracker->Untrack(*this);
+            }
+
+            if (ReadyLoop) {
+                ReadyLoop->Unready(*this);
+            }
+
+            // io_uring polls hold on to the file, closing the fd doesn't
+            // end them
+            if (RegLoop && (RegSlot >= 0)) {
+                RegLoop->RemoveEvent(*this);
+            }
+        }
+
+        void TNode::SetPriority(int priority) {
+            if ((priority < 0) || (priority >= MUHEV_PRIORITY_COUNT)) {
+                throw std::logic_error("Invalid node priority");
+            }
+
+            if (priority == Priority) {
+                return;
+            }
+
+            TLoop* loop = ReadyLoop;
+            const int filter = ReadyFilter;
+            const int flags = ReadyFlags;
+
+            if (loop) {
+                loop->Unready(*this);
+            }
+
+            Priority = priority;
+
+            if (loop) {
+                loop->Ready(*this, filter, flags);
+            }
+        }
+
+        void TNode::Finish() {
+            Finished = true;
+
+            if (Tracker) {
+                Tracker->Untrack(*this);
+            }
+        }
+
         void TNode::Drain() {
             char dummy[128];
             int rv = recvfrom(
@@ -1,23 +1,97 @@
 #pragma once
 
+#include "muhev_timer.hpp"
+#include "mpsc_queue.hpp"
+#include "frame_pool.hpp"
+#include "muhev_trigger_set.hpp"
+#ifndef __linux__
+    #include "spin_lock.hpp"
+#endif
+#ifdef AC_MUHEV_STATS
+    #include "muhev_stats.hpp"
+#endif
 #include <memory>
 #include <utility>
 #include <type_traits>
+#include <atomic>
+#include <limits>
+#include <vector>
+
+#ifdef __linux__
+    struct epoll_event;
+#else
+    struct kevent;
+#endif
 
 namespace NAC {
     namespace NMuhEv {
+#ifdef __linux__
+        using TInternalEvStruct = struct ::epoll_event;
+#else
+        using TInternalEvStruct = struct ::kevent;
+#endif
+
+        class TLoop;
+#ifdef __linux__
+        class TUring;
+#endif
+
         enum EEvFilter {
             MUHEV_FILTER_NONE = 0,
             MUHEV_FILTER_READ = 2,
-            MUHEV_FILTER_WRITE = 4
+            MUHEV_FILTER_WRITE = 4,
+            // kqueue EVFILT_USER, ident is not an fd
+            MUHEV_FILTER_USER = 8
         };
 
         enum EEvFlags {
-            MUHEV_FLAG_NONE = 0
+            MUHEV_FLAG_NONE = 0,
+
+            // Registration: report only state changes (EPOLLET/EV_CLEAR)
+            MUHEV_FLAG_EDGE = 1,
+            // Registration: disarm after the first event until AddEvent()
+            // is called again (EPOLLONESHOT/EV_ONESHOT), lets several
+            // threads Wait() on one loop
+            MUHEV_FLAG_ONESHOT = 2,
+
+            // Reported: peer closed its end or the fd hung up
+            MUHEV_FLAG_EOF = 4,
+            // Reported: error pending on the fd
+            MUHEV_FLAG_ERROR = 8
         };
 
+        // Ready nodes are dispatched strictly by priority, FIFO within one
+        enum EEvPriority {
+            MUHEV_PRIORITY_HIGH = 0,
+            MUHEV_PRIORITY_NORMAL = 1,
+            MUHEV_PRIORITY_LOW = 2,
+
+            MUHEV_PRIORITY_COUNT = 3
+        };
+
+        enum EEvBackend {
+            // epoll or kqueue
+            MUHEV_BACKEND_DEFAULT = 0,
+            // Linux 5.11+, falls back to the default one when unavailable.
+            // Polls keep the file open, so registered nodes must be removed
+            // or destroyed before their loop; only one thread may Wait().
+            MUHEV_BACKEND_URING = 1
+        };
+
+        // Signals an eventfd
         void TriggerFd(int fd);
 
+        class TNode;
+
+        namespace NLoopPrivate {
+            // Nodes tracked together, the loop's own ones or those of one
+            // WaitUntilComplete(container) call
+            struct TTrackList {
+                TNode* Head = nullptr;
+                size_t Count = 0;
+            };
+        }
+
         class TNode {
         public:
             TNode(
@@ -31,8 +105,7 @@ namespace NAC {
             {
             }
 
-            virtual ~TNode() {
-            }
+            virtual ~TNode();
 
             virtual void Cb(int filter, int flags) = 0;
 
@@ -49,34 +122,90 @@ namespace NAC {
             }
 
             virtual bool IsAlive() const {
-                return true;
+                return !Finished;
+            }
+
+            int GetPriority() const {
+                return Priority;
             }
 
+            // Loop thread only
+            void SetPriority(int priority);
+
         protected:
             void Drain();
 
+            // Marks the node dead and lets the loop tracking it know right
+            // away; nodes overriding IsAlive() only need this when they die
+            // outside of their Cb()
+            void Finish();
+
         protected:
             int EvIdent = 0;
             int EvFilter = MUHEV_FILTER_NONE;
             int EvFlags = MUHEV_FLAG_NONE;
+
+        private:
+            friend class TLoop;
+
+            // What the loop has last told the kernel about this node
+            TLoop* RegLoop = nullptr;
+            int RegIdent = -1;
+            int RegFilter = MUHEV_FILTER_NONE;
+            int RegFlags = MUHEV_FLAG_NONE;
+            // Poll request of an io_uring loop
+            int RegSlot = -1;
+
+            TLoop* Tracker = nullptr;
+            NLoopPrivate::TTrackList* TrackList = nullptr;
+            TNode* TrackPrev = nullptr;
+            TNode* TrackNext = nullptr;
+            bool Finished = false;
+
+            // Readiness waiting for dispatch
+            TLoop* ReadyLoop = nullptr;
+            TNode* ReadyPrev = nullptr;
+            TNode* ReadyNext = nullptr;
+            int ReadyFilter = MUHEV_FILTER_NONE;
+            int ReadyFlags = MUHEV_FLAG_NONE;
+            int Priority = MUHEV_PRIORITY_NORMAL;
         };
 
+        // fds[1] is what the loop watches, fds[0] is used to trigger it:
+        // an eventfd (both the same) on Linux, the kqueue and an EVFILT_USER
+        // ident elsewhere
         class TTriggerNodeBase : public TNode {
         public:
             TTriggerNodeBase(int* fds)
+#ifdef __linux__
                 : TNode(fds[1], MUHEV_FILTER_READ)
+#else
+                : TNode(fds[1], MUHEV_FILTER_USER)
+#endif
                 , TriggerFd_(fds[0])
             {
             }
 
             ~TTriggerNodeBase();
 
+            // Triggers issued before the callback starts are coalesced
+            // into one wakeup, only the first one makes a syscall
             void Trigger() const {
-                TriggerFd(TriggerFd_);
+                if (!Pending.exchange(true, std::memory_order_acq_rel)) {
+                    TriggerImpl();
+                }
             }
 
+        protected:
+            // Must be called before handling the trigger
+            void Drain();
+
+        private:
+            void TriggerImpl() const;
+
         private:
             int TriggerFd_;
+            mutable std::atomic<bool> Pending{false};
         };
 
         struct TDerefAliveChecker {
@@ -93,6 +222,38 @@ namespace NAC {
             }
         };
 
+        namespace NLoopPrivate {
+            // Overload ranks: the higher one wins
+            template<unsigned N>
+            struct TPick : public TPick<N - 1> {
+            };
+
+            template<>
+            struct TPick<0> {
+            };
+
+            template<typename TAliveChecker, typename T>
+            static inline auto NodeOf(T& value, TPick<2>) -> decltype(static_cast<TNode*>(&TAliveChecker::Get(value))) {
+                return &TAliveChecker::Get(value);
+            }
+
+            template<typename TAliveChecker, typename T>
+            static inline auto NodeOf(T& value, TPick<1>) -> decltype(static_cast<TNode*>(&*value)) {
+                return &*value;
+            }
+
+            template<typename TAliveChecker, typename T>
+            static inline auto NodeOf(T& value, TPick<0>) -> decltype(static_cast<TNode*>(&value)) {
+                return &value;
+            }
+
+            // Neither a checker's Get() nor a TNode in sight
+            template<typename TAliveChecker, typename T>
+            static inline TNode* NodeOf(T&, ...) {
+                return nullptr;
+            }
+        }
+
         template<typename TCb>
         class TTriggerNode : public TTriggerNodeBase {
         public:
@@ -111,22 +272,200 @@ namespace NAC {
             TCb Cb_;
         };
 
+        // Trigger without an fd of its own: all of a loop's light triggers
+        // share its wakeup and only the fired ones run
+        class TLightTrigger {
+        public:
+            TLightTrigger(TLoop& loop);
+            TLightTrigger(const TLightTrigger&) = delete;
+            TLightTrigger(TLightTrigger&&) = delete;
+
+            // Callbacks run on the loop's main waiter. Destroying a trigger
+            // on another thread waits for callbacks running there to return.
+            virtual ~TLightTrigger();
+
+            virtual void Cb() = 0;
+
+            // Thread-safe, triggers issued before the callback starts are
+            // coalesced
+            void Trigger() const;
+
+        protected:
+            // Stops callbacks, waiting for a running one as the destructor
+            // does. Subclasses with state Cb() uses call it first thing in
+            // their destructor, the base one comes too late for that.
+            void Detach();
+
+        private:
+            TLoop& Loop;
+            size_t Index;
+            bool Detached = false;
+        };
+
+        template<typename TCb>
+        class TLightTriggerNode : public TLightTrigger {
+        public:
+            TLightTriggerNode(TLoop& loop, TCb&& cb)
+                : TLightTrigger(loop)
+                , Cb_(std::forward<TCb>(cb))
+            {
+            }
+
+            ~TLightTriggerNode() {
+                Detach();
+            }
+
+            void Cb() override {
+                Cb_();
+            }
+
+        private:
+            typename std::decay<TCb>::type Cb_;
+        };
+
+        class TPostedTask : public NUtils::TMPSCNode {
+        public:
+            virtual ~TPostedTask() {
+            }
+
+            virtual void Run() = 0;
+        };
+
+        template<typename TCb>
+        class TPostedTaskImpl : public TPostedTask {
+        public:
+            TPostedTaskImpl(TCb&& cb)
+                : Cb_(std::move(cb))
+            {
+            }
+
+            TPostedTaskImpl(const TCb& cb)
+                : Cb_(cb)
+            {
+            }
+
+            void Run() override {
+                Cb_();
+            }
+
+        private:
+            TCb Cb_;
+        };
+
         class TLoop {
         private:
+            struct TReadyList {
+                TNode* Head = nullptr;
+                TNode* Tail = nullptr;
+                size_t Size = 0;
+            };
+
             int QueueId;
             std::unique_ptr<TTriggerNodeBase> WakeupNode;
+            TTimerWheel Timers;
+            TTriggerSet LightTriggers;
+            NUtils::TMPSCQueue Posted;
+            std::atomic<size_t> PostedCount_{0};
+            std::atomic<size_t> PostLimit{std::numeric_limits<size_t>::max()};
+            NUtils::TFramePool FramePool;
+            std::vector<TInternalEvStruct> Events;
+            std::atomic<bool> EventsBusy{false};
+            NLoopPrivate::TTrackList Tracked;
+            TReadyList ReadyLists[MUHEV_PRIORITY_COUNT];
+            uint64_t DispatchBudgetNs = 0;
+            std::vector<std::unique_ptr<TPostedTask>> Deferred;
+            uint64_t BusyPollNs = 0;
+            uint64_t SpinNs = 0;
+            NUtils::TMPSCQueue Retired;
+            std::atomic<size_t> RetiredCount{0};
+            // Waiters other than the owner of Events count themselves under
+            // the current phase, nodes retired in a phase are freed once the
+            // loop has moved on and the phase has no waiters left
+            std::atomic<unsigned> Phase{0};
+            std::atomic<size_t> Readers[2] = {};
+            std::vector<TNode*> Grace[2];
+            // Set while the thread owning Events blocks in Wait()
+            std::atomic<bool> OwnerPolling{false};
+#ifdef AC_MUHEV_STATS
+            TLoopStats Stats;
+#endif
+#ifndef __linux__
+            // Changes made from callbacks, submitted with the next kevent()
+            NUtils::TSpinLock ChangesLock;
+            std::vector<TInternalEvStruct> Changes;
+#else
+            std::unique_ptr<TUring> Uring;
+#endif
 
         public:
-            TLoop();
+            // Some backends may be unavailable at runtime, GetBackend()
+            // tells which one is in use
+            TLoop(int backend = MUHEV_BACKEND_DEFAULT);
             ~TLoop();
 
         public:
+            // Registrations are cached per node, so calls that don't change
+            // anything cost no syscalls; mod is only a hint now. On kqueue,
+            // changes made from callbacks are applied by the next Wait().
             void AddEvent(TNode& node, bool mod = true);
             void RemoveEvent(TNode& node);
 
             void Wake();
             bool Wait(const size_t capacity = 100);
 
+            int GetBackend() const;
+
+#ifdef __linux__
+            // nullptr unless the loop uses io_uring, see TUringOp
+            TUring* GetUring() {
+                return Uring.get();
+            }
+#endif
+
+            // Wait() polls without blocking for up to budgetUs before going
+            // to sleep, trading a busy CPU for wakeup latency. The window
+            // adapts: it grows when spinning finds events and shrinks to
+            // nothing on an idle loop. 0 turns it off. Not for loops that
+            // several threads Wait() on.
+            void SetBusyPoll(uint64_t budgetUs);
+
+            // The ready nodes of a Wait() round run by priority until their
+            // callbacks have taken budgetUs in total, the rest are carried
+            // over to the next round ahead of new events of the same
+            // priority. At least one callback runs per round; 0 (default)
+            // means no limit.
+            void SetDispatchBudget(uint64_t budgetUs) {
+                DispatchBudgetNs = budgetUs * 1000;
+            }
+
+            // For nodes that stop before consuming all of their input, e.g.
+            // edge-triggered ones with a per-callback byte limit: calls
+            // node's Cb(filter, 0) again in the next round, which doesn't
+            // block. Loop thread only.
+            void Yield(TNode& node, int filter) {
+                Ready(node, filter, MUHEV_FLAG_NONE);
+            }
+
+            // Loop thread only. cb runs after the I/O callbacks of the
+            // current round (or of the next one when called from outside
+            // of them), before posted tasks and timers.
+            template<typename TCb>
+            void Defer(TCb&& cb) {
+                Deferred.emplace_back(new TPostedTaskImpl<typename std::decay<TCb>::type>(std::forward<TCb>(cb)));
+            }
+
+            // Thread-safe, takes ownership. The loop unregisters node and
+            // deletes it once no Wait() can still hold a pointer to it, so
+            // it may get callbacks until the end of the current round. Its
+            // fd must stay open until then. Loops that several threads
+            // Wait() on free it after every waiter has started over.
+            void Retire(TNode* node);
+
+            template<typename T>
+            void Retire(std::unique_ptr<T>&& node) {
+                Retire(static_cast<TNode*>(node.release()));
+            }
+
             template<typename TCb>
             std::unique_ptr<TTriggerNodeBase> NewTrigger(TCb&& cb) {
                 int fds[2];
@@ -139,8 +478,127 @@ namespace NAC {
                 return out;
             }
 
+            // Any number of these share the loop's wakeup fd
+            template<typename TCb>
+            std::unique_ptr<TLightTrigger> NewLightTrigger(TCb&& cb) {
+                return std::unique_ptr<TLightTrigger>(new TLightTriggerNode<TCb>(*this, std::forward<TCb>(cb)));
+            }
+
+            // Wait() sleeps no longer than the next timer expiry and fires
+            // due timers after dispatching I/O events. Timers are run by the
+            // loop's main waiter (the one not nested in a callback) and may
+            // only be scheduled or cancelled from its thread.
+            void Schedule(TTimer& timer, uint64_t delayMs) {
+                Timers.Schedule(timer, delayMs);
+            }
+
+            void Cancel(TTimer& timer) {
+                Timers.Cancel(timer);
+            }
+
+            template<typename TCb>
+            std::unique_ptr<TTimer> NewTimer(TCb&& cb) {
+                return std::unique_ptr<TTimer>(new TTimerNode<TCb>(std::forward<TCb>(cb)));
+            }
+
+            TTimerWheel& GetTimers() {
+                return Timers;
+            }
+
+            // Thread-safe. cb (may be move-only) runs on the loop thread
+            // after the I/O events of a Wait(); a burst of posts wakes the
+            // loop once.
+            template<typename TCb>
+            void Post(TCb&& cb) {
+                PostedCount_.fetch_add(1, std::memory_order_relaxed);
+                PostImpl(new TPostedTaskImpl<typename std::decay<TCb>::type>(std::forward<TCb>(cb)));
+            }
+
+            // Like Post(), but fails once SetPostLimit() tasks are queued
+            template<typename TCb>
+            bool TryPost(TCb&& cb) {
+                size_t count = PostedCount_.load(std::memory_order_relaxed);
+
+                do {
+                    if (count >= PostLimit.load(std::memory_order_relaxed)) {
+                        return false;
+                    }
+
+                } while (!PostedCount_.compare_exchange_weak(count, count + 1, std::memory_order_relaxed));
+
+                PostImpl(new TPostedTaskImpl<typename std::decay<TCb>::type>(std::forward<TCb>(cb)));
+
+                return true;
+            }
+
+            void SetPostLimit(size_t limit) {
+                PostLimit.store(limit, std::memory_order_relaxed);
+            }
+
+            size_t PostedCount() const {
+                return PostedCount_.load(std::memory_order_relaxed);
+            }
+
+            // Loop thread only
+            NUtils::TFramePool& GetFramePool() {
+                return FramePool;
+            }
+
+            // True on the loop thread: the main waiter, while in Wait()
+            bool IsLoopThread() const;
+
+#ifdef AC_MUHEV_STATS
+            // Snapshot() and SetStallThreshold() may be used from any
+            // thread; timers are accounted as one TTimerWheel callback
+            TLoopStats& GetStats() {
+                return Stats;
+            }
+#endif
+
+            // Counts node as pending until it dies: its IsAlive() turns
+            // false after a Cb(), it calls Finish() or it is destroyed.
+            // Other deaths are noticed by WaitUntilComplete() at the latest
+            // at the end of the round after which no tracked node is alive.
+            void Track(TNode& node);
+            void Untrack(TNode& node);
+
+            size_t TrackedCount() const {
+                return Tracked.Count;
+            }
+
+            // Runs until every tracked node is dead
+            bool WaitUntilComplete();
+
+            // Waits for the live clients in container only, leaves the ones
+            // still alive (if Wait() failed) in it. Their nodes are tracked
+            // for the duration of the call, a node comes from
+            // TAliveChecker::Get() if there is one, else from *client or the
+            // client itself. Without one, or if the node is tracked
+            // elsewhere already (and left so), the container is rescanned
+            // after every round instead.
             template<typename T, typename TAliveChecker = TDerefAliveChecker>
             bool WaitUntilComplete(T&& container) {
+                using NLoopPrivate::NodeOf;
+                using NLoopPrivate::TPick;
+
+                NLoopPrivate::TTrackList list;
+                bool rescan = false;
+
+                for (auto&& client : container) {
+                    if (TAliveChecker::Check(client)) {
+                        TNode* node = NodeOf<TAliveChecker>(client, TPick<2>());
+
+                        if (node && !node->Tracker) {
+                            Track(*node, list);
+
+                        } else {
+                            rescan = true;
+                        }
+                    }
+                }
+
+                bool out = true;
+
                 while (true) {
                     typename std::remove_reference<T>::type tmp;
 
@@ -152,20 +610,48 @@ namespace NAC {
 
                     std::swap(container, tmp);
 
-                    if (tmp.empty()) {
+                    if (!out || container.empty()) {
                         break;
                     }
 
-                    if (!Wait(container.size())) {
-                        return false;
+                    if (!rescan && (list.Count > 0)) {
+                        out = WaitUntilComplete(list);
+
+                    } else {
+                        out = Wait(container.size());
                     }
                 }
 
-                return true;
+                while (list.Head) {
+                    Untrack(*list.Head);
+                }
+
+                return out;
             }
 
         private:
-            static void MakeFds(int* out);
+            friend class TNode;
+            friend class TLightTrigger;
+
+            void MakeFds(int* out);
+#ifndef __linux__
+            void Change(int ident, int filter, int flags, TNode* node);
+            void DropChanges(TNode& node);
+#endif
+            void PostImpl(TPostedTask* task);
+            void RunPosted();
+            void Ready(TNode& node, int filter, int flags);
+            void Unready(TNode& node);
+            bool HasReady() const;
+            void Dispatch(TNode& node, int filter, int flags);
+            void DispatchReady();
+            void RunDeferred();
+            void Reclaim();
+            void Track(TNode& node, NLoopPrivate::TTrackList& list);
+            bool WaitUntilComplete(NLoopPrivate::TTrackList& list);
+            void UntrackDead(NLoopPrivate::TTrackList& list);
+            int Poll(TInternalEvStruct* list, size_t changes, size_t capacity, int64_t timeoutMs);
+            int Spin(TInternalEvStruct* list, size_t changes, size_t capacity, int64_t timeoutMs);
         };
     }
 }
@@ -0,0 +1,378 @@
+#include "muhev_connection.hpp"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+namespace NAC {
+    namespace NMuhEv {
+        namespace {
+            static const size_t CHUNK_SIZE = NUtils::TFramePool::MAX_SIZE;
+            static const size_t READ_CHUNKS = 8;
+            static const size_t WRITE_IOV = 64;
+            // Small copied writes are merged into one buffer up to this size
+            static const size_t COALESCE_SIZE = 4096;
+
+            static inline bool IsAgain() {
+                return ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+            }
+        }
+
+        TConnectionNode::TConnectionNode(TLoop& loop, int fd)
+            : TNode(fd, MUHEV_FILTER_READ)
+            , Loop(loop)
+            , Self(std::make_shared<TConnectionNode*>(this))
+        {
+        }
+
+        TConnectionNode::~TConnectionNode() {
+            // A scheduled flush may still be pending
+            *Self = nullptr;
+
+            if (!Closed) {
+                Loop.RemoveEvent(*this);
+                close(EvIdent);
+            }
+
+            FreeInput();
+        }
+
+        void TConnectionNode::Cb(int filter, int) {
+            if (Closed) {
+                return;
+            }
+
+            if (filter & MUHEV_FILTER_READ) {
+                try {
+                    Read();
+
+                } catch (...) {
+                    Close(EPROTO);
+                    return;
+                }
+            }
+
+            // Covers both the writability event and whatever the parser
+            // has queued, along with the rest of the round's Send()s
+            Flush();
+        }
+
+        void TConnectionNode::Send(TBlob&& data) {
+            if (Closed || (data.Size() == 0)) {
+                return;
+            }
+
+            OutputSize_ += data.Size();
+            Output.emplace_back();
+            Output.back().Data = std::move(data);
+        }
+
+        void TConnectionNode::Send(const std::shared_ptr<TBlob>& data) {
+            if (Closed || !data || (data->Size() == 0)) {
+                return;
+            }
+
+            OutputSize_ += data->Size();
+            Output.emplace_back();
+            Output.back().Shared = data;
+        }
+
+        void TConnectionNode::Send(const size_t size, const char* data) {
+            if (Closed || (size == 0)) {
+                return;
+            }
+
+            OutputSize_ += size;
+
+            if (
+                !Output.empty()
+                && Output.back().Copy
+                && ((Output.back().Data.Size() + size) <= COALESCE_SIZE)
+            ) {
+                Output.back().Data.Append(size, data);
+                return;
+            }
+
+            Output.emplace_back();
+            Output.back().Data.Append(size, data);
+            Output.back().Copy = (size < COALESCE_SIZE);
+        }
+
+        bool TConnectionNode::Flush() {
+            if (Closed) {
+                return false;
+            }
+
+            // Other waiters run callbacks on their own threads
+            if (!Loop.IsLoopThread()) {
+                return FlushNow();
+            }
+
+            if (!FlushScheduled) {
+                FlushScheduled = true;
+
+                Loop.Defer([self = Self]() {
+                    if (TConnectionNode* node = *self) {
+                        node->FlushScheduled = false;
+                        node->FlushNow();
+                    }
+                });
+            }
+
+            return true;
+        }
+
+        bool TConnectionNode::FlushNow() {
+            if (Closed) {
+                return false;
+            }
+
+            if (!Write()) {
+                return false;
+            }
+
+            if (Output.empty() && CloseWhenFlushed) {
+                Close(0);
+                return false;
+            }
+
+            if (!ReadPaused && (OutputSize_ > High)) {
+                ReadPaused = true;
+
+            } else if (ReadPaused && (OutputSize_ <= Low)) {
+                ReadPaused = false;
+            }
+
+            UpdateInterest();
+
+            return true;
+        }
+
+        void TConnectionNode::CloseAfterFlush() {
+            CloseWhenFlushed = true;
+        }
+
+        void TConnectionNode::Close(int error) {
+            if (Closed) {
+                return;
+            }
+
+            Closed = true;
+
+            Loop.RemoveEvent(*this);
+            close(EvIdent);
+
+            FreeInput();
+            Output.clear();
+            OutputSize_ = 0;
+
+            Finish();
+            OnClose(error);
+        }
+
+        void TConnectionNode::Read() {
+            if (ReadPaused || CloseWhenFlushed) {
+                return;
+            }
+
+            NUtils::TFramePool& pool = Loop.GetFramePool();
+            size_t total = 0;
+            ssize_t rv = 0;
+
+            // Fills the tail chunk first, a new one is taken only once it
+            // is full and the socket has more
+            for (size_t i = 0; i < READ_CHUNKS; ++i) {
+                if (Input.empty() || (Input.back().End == CHUNK_SIZE)) {
+                    Input.emplace_back(TInChunk{(char*)pool.Allocate(CHUNK_SIZE), 0, 0});
+                }
+
+                TInChunk& chunk = Input.back();
+                const size_t room = CHUNK_SIZE - chunk.End;
+
+                do {
+                    rv = read(EvIdent, chunk.Data + chunk.End, room);
+
+                } while ((rv == -1) && (errno == EINTR));
+
+                if (rv <= 0) {
+                    if (chunk.End == 0) {
+                        pool.Free(chunk.Data, CHUNK_SIZE);
+                        Input.pop_back();
+                    }
+
+                    break;
+                }
+
+                chunk.End += rv;
+                total += rv;
+
+                if ((size_t)rv < room) {
+                    break;
+                }
+            }
+
+            const int error = ((rv == -1) ? errno : 0);
+
+            if (total > 0) {
+                InputSize_ += total;
+                Parse();
+            }
+
+            if (Closed) {
+                return;
+            }
+
+            if (rv == 0) {
+                CloseAfterFlush();
+
+            } else if ((rv == -1) && (error != EAGAIN) && (error != EWOULDBLOCK)) {
+                Close(error);
+            }
+        }
+
+        void TConnectionNode::Parse() {
+            while (!Closed && (InputSize_ > 0)) {
+                TBlobSequence input;
+
+                for (const auto& chunk : Input) {
+                    input.Concat(chunk.End - chunk.Begin, chunk.Data + chunk.Begin);
+                }
+
+                const size_t consumed = OnData(input);
+
+                if (Closed || (consumed == 0)) {
+                    break;
+                }
+
+                Consume(std::min(consumed, InputSize_));
+            }
+        }
+
+        void TConnectionNode::Consume(size_t size) {
+            InputSize_ -= size;
+
+            while (size > 0) {
+                TInChunk& chunk = Input.front();
+                const size_t avail = chunk.End - chunk.Begin;
+
+                if (size < avail) {
+                    chunk.Begin += size;
+                    break;
+                }
+
+                size -= avail;
+                Loop.GetFramePool().Free(chunk.Data, CHUNK_SIZE);
+                Input.pop_front();
+            }
+        }
+
+        bool TConnectionNode::Write() {
+            while (!Output.empty()) {
+                struct iovec iov[WRITE_IOV];
+                size_t count = 0;
+
+                for (const auto& item : Output) {
+                    if (count == WRITE_IOV) {
+                        break;
+                    }
+
+                    iov[count].iov_base = (void*)item.Ptr();
+                    iov[count].iov_len = item.Left();
+                    ++count;
+                }
+
+                ssize_t rv;
+
+                if (NotSocket) {
+                    rv = writev(EvIdent, iov, count);
+
+                } else {
+                    struct msghdr msg = {};
+                    msg.msg_iov = iov;
+                    msg.msg_iovlen = count;
+
+                    int flags = 0;
+
+#ifdef MSG_NOSIGNAL
+                    flags |= MSG_NOSIGNAL;
+#endif
+
+#ifdef MSG_MORE
+                    // Holds back a partial segment until the rest follows,
+                    // like TCP_CORK without the two extra setsockopt()s
+                    if (count < Output.size()) {
+                        flags |= MSG_MORE;
+                    }
+#endif
+
+                    rv = sendmsg(EvIdent, &msg, flags);
+
+                    if ((rv == -1) && (errno == ENOTSOCK)) {
+                        NotSocket = true;
+                        continue;
+                    }
+                }
+
+                if (rv == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+
+                    if (IsAgain()) {
+                        break;
+                    }
+
+                    Close(errno);
+                    return false;
+                }
+
+                size_t left = rv;
+                OutputSize_ -= left;
+
+                while (left > 0) {
+                    TOutItem& item = Output.front();
+                    const size_t size = item.Left();
+
+                    if (left < size) {
+                        item.Offset += left;
+                        break;
+                    }
+
+                    left -= size;
+                    Output.pop_front();
+                }
+            }
+
+            return true;
+        }
+
+        void TConnectionNode::UpdateInterest() {
+            int filter = MUHEV_FILTER_NONE;
+
+            if (!ReadPaused && !CloseWhenFlushed) {
+                filter |= MUHEV_FILTER_READ;
+            }
+
+            if (!Output.empty()) {
+                filter |= MUHEV_FILTER_WRITE;
+            }
+
+            if (filter != EvFilter) {
+                EvFilter = filter;
+                Loop.AddEvent(*this);
+            }
+        }
+
+        void TConnectionNode::FreeInput() {
+            for (const auto& chunk : Input) {
+                Loop.GetFramePool().Free(chunk.Data, CHUNK_SIZE);
+            }
+
+            Input.clear();
+            InputSize_ = 0;
+        }
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "muhev.hpp"
+#include "str.hpp"
+#include "string_sequence.hpp"
+#include <deque>
+#include <memory>
+#include <string>
+#include <limits>
+
+namespace NAC {
+    namespace NMuhEv {
+        // Buffered connection over an owned non-blocking fd. Input is read
+        // into chunks from the loop's TFramePool and handed to OnData();
+        // output queued with Send() during a loop round goes out at its
+        // end, in as few writev()/sendmsg() calls as possible.
+        //
+        // Registration is up to the caller (TLoop::AddEvent() or
+        // TReactorPool), after that the node switches its own interest.
+        // Once closed it is dead and its fd is already closed.
+        class TConnectionNode : public TNode {
+        public:
+            TConnectionNode() = delete;
+            TConnectionNode(const TConnectionNode&) = delete;
+            TConnectionNode(TConnectionNode&&) = delete;
+
+            TConnectionNode(TLoop& loop, int fd);
+            ~TConnectionNode();
+
+            void Cb(int filter, int flags) override;
+
+            // Queued data is written once Flush() is called, which the
+            // node's own callback does
+            void Send(TBlob&& data);
+            void Send(const std::shared_ptr<TBlob>& data);
+            void Send(const size_t size, const char* data);
+
+            void Send(const std::string& data) {
+                Send(data.size(), data.data());
+            }
+
+            // Writes the queued data after the I/O callbacks of the current
+            // round, along with what is sent until then (or right away on a
+            // thread other than the loop's). false if the connection is
+            // closed.
+            bool Flush();
+
+            // Reading stops while more than high bytes wait to be written
+            // and resumes once no more than low are left
+            void SetWatermarks(size_t high, size_t low) {
+                High = high;
+                Low = low;
+            }
+
+            // Stops reading and closes once the output is written
+            void CloseAfterFlush();
+
+            // Drops unsent output, error is passed to OnClose()
+            void Close(int error = 0);
+
+            bool IsClosed() const {
+                return Closed;
+            }
+
+            bool IsReadPaused() const {
+                return ReadPaused;
+            }
+
+            size_t InputSize() const {
+                return InputSize_;
+            }
+
+            size_t OutputSize() const {
+                return OutputSize_;
+            }
+
+            TLoop& GetLoop() const {
+                return Loop;
+            }
+
+        protected:
+            // Gets all unconsumed input and returns how much of it has been
+            // consumed; called again while that is more than zero. Throwing
+            // closes the connection with EPROTO.
+            virtual size_t OnData(const TBlobSequence& input) = 0;
+
+            // Called once, error is 0 on EOF or a clean local close
+            virtual void OnClose(int) {
+            }
+
+        private:
+            struct TInChunk {
+                char* Data;
+                size_t Begin;
+                size_t End;
+            };
+
+            struct TOutItem {
+                TBlob Data;
+                std::shared_ptr<TBlob> Shared;
+                size_t Offset = 0;
+                bool Copy = false;
+
+                const char* Ptr() const {
+                    return ((Shared ? Shared->Data() : Data.Data()) + Offset);
+                }
+
+                size_t Left() const {
+                    return ((Shared ? Shared->Size() : Data.Size()) - Offset);
+                }
+            };
+
+        private:
+            void Read();
+            void Parse();
+            void Consume(size_t size);
+            bool FlushNow();
+            bool Write();
+            void UpdateInterest();
+            void FreeInput();
+
+        private:
+            TLoop& Loop;
+            // Cleared on destruction, for the pending flush
+            std::shared_ptr<TConnectionNode*> Self;
+            std::deque<TInChunk> Input;
+            std::deque<TOutItem> Output;
+            size_t InputSize_ = 0;
+            size_t OutputSize_ = 0;
+            size_t High = std::numeric_limits<size_t>::max();
+            size_t Low = 0;
+            bool Closed = false;
+            bool CloseWhenFlushed = false;
+            bool FlushScheduled = false;
+            bool ReadPaused = false;
+            bool NotSocket = false;
+        };
+    }
+}
@@ -0,0 +1,484 @@
+#pragma once
+
+#include "muhev.hpp"
+#include "utils/socket.hpp"
+
+#ifdef __cpp_impl_coroutine
+
+#include <coroutine>
+#include <stdexcept>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+namespace NAC {
+    namespace NMuhEv {
+        class TAsyncFd;
+
+        namespace NCoroPrivate {
+            struct alignas(16) TFrameHeader {
+                // Loop whose pool the frame comes from, nullptr for the heap
+                TLoop* Loop;
+                size_t Size;
+            };
+
+            static inline TLoop* LoopOf(TLoop& loop) {
+                return &loop;
+            }
+
+            static inline TLoop* LoopOf(TAsyncFd& fd);
+
+            template<typename T>
+            static inline TLoop* LoopOf(T&) {
+                return nullptr;
+            }
+
+            template<typename... TArgs>
+            static inline TLoop* FindLoop(TArgs&... args) {
+                TLoop* out = nullptr;
+                ((out = (out ? out : LoopOf(args))), ...);
+
+                return out;
+            }
+
+            static inline void* AllocateFrame(TLoop* loop, size_t size) {
+                size += sizeof(TFrameHeader);
+
+                // The pool is single-threaded
+                if (loop && !loop->IsLoopThread()) {
+                    loop = nullptr;
+                }
+
+                auto header = (TFrameHeader*)(loop ? loop->GetFramePool().Allocate(size) : ::operator new(size));
+                header->Loop = loop;
+                header->Size = size;
+
+                return (header + 1);
+            }
+
+            static inline void FreeFrame(void* ptr) {
+                auto header = ((TFrameHeader*)ptr - 1);
+                TLoop* loop = header->Loop;
+
+                if (!loop) {
+                    ::operator delete(header);
+
+                } else if (loop->IsLoopThread()) {
+                    loop->GetFramePool().Free(header, header->Size);
+
+                } else {
+                    // Finished elsewhere, e.g. after a TResumeOn
+                    const size_t size = header->Size;
+
+                    loop->Post([loop, header, size]() {
+                        loop->GetFramePool().Free(header, size);
+                    });
+                }
+            }
+        }
+
+        // Fire-and-forget coroutine: runs until the first suspension right
+        // away and frees its frame when done. Started on the thread of the
+        // first TLoop& or TAsyncFd& argument's loop, the frame comes from
+        // that loop's pool, from the heap otherwise; finishing on another
+        // thread hands it back through Post(). Exceptions are swallowed,
+        // like the ones thrown from TNode::Cb.
+        class TCoroTask {
+        public:
+            struct promise_type {
+                template<typename... TArgs>
+                static void* operator new(size_t size, TArgs&... args) {
+                    return NCoroPrivate::AllocateFrame(NCoroPrivate::FindLoop(args...), size);
+                }
+
+                static void operator delete(void* ptr) {
+                    NCoroPrivate::FreeFrame(ptr);
+                }
+
+                TCoroTask get_return_object() {
+                    return {};
+                }
+
+                std::suspend_never initial_suspend() noexcept {
+                    return {};
+                }
+
+                std::suspend_never final_suspend() noexcept {
+                    return {};
+                }
+
+                void return_void() {
+                }
+
+                void unhandled_exception() {
+                }
+            };
+        };
+
+        class TIoAwaiter {
+        public:
+            enum EOp {
+                OP_READABLE,
+                OP_WRITABLE,
+                OP_READ,
+                OP_WRITE,
+                OP_ACCEPT,
+            };
+
+        public:
+            TIoAwaiter(TAsyncFd& fd, EOp op, char* data, size_t size, uint64_t timeoutMs)
+                : Fd(fd)
+                , Op(op)
+                , Data(data)
+                , Size(size)
+                , TimeoutMs(timeoutMs)
+            {
+                Timeout.Awaiter = this;
+            }
+
+            TIoAwaiter(const TIoAwaiter&) = delete;
+
+            bool await_ready() {
+                return Try();
+            }
+
+            void await_suspend(std::coroutine_handle<> handle);
+
+            // -1 with errno set on error, ETIMEDOUT on timeout
+            ssize_t await_resume() const {
+                if (Result < 0) {
+                    errno = Error;
+                }
+
+                return Result;
+            }
+
+        private:
+            friend class TAsyncFd;
+
+            struct TTimeout : public TTimer {
+                TIoAwaiter* Awaiter = nullptr;
+
+                void Cb() override {
+                    Awaiter->OnTimeout();
+                }
+            };
+
+        private:
+            bool IsWrite() const {
+                return ((Op == OP_WRITABLE) || (Op == OP_WRITE));
+            }
+
+            bool Try();
+            void Resume();
+            void OnTimeout();
+
+        private:
+            TAsyncFd& Fd;
+            EOp Op;
+            char* Data;
+            size_t Size;
+            size_t Done = 0;
+            uint64_t TimeoutMs;
+            ssize_t Result = 0;
+            int Error = 0;
+            std::coroutine_handle<> Handle;
+            TTimeout Timeout;
+        };
+
+        // Non-blocking fd registered once, edge-triggered, with its loop.
+        // At most one reading and one writing awaiter at a time; they are
+        // resumed from TLoop::Wait() on the loop thread.
+        class TAsyncFd : public TNode {
+        public:
+            TAsyncFd(TLoop& loop, int fd, bool own = true)
+                : TNode(fd, MUHEV_FILTER_READ | MUHEV_FILTER_WRITE, MUHEV_FLAG_EDGE)
+                , Loop(loop)
+                , Own(own)
+            {
+                Loop.AddEvent(*this, /* mod = */false);
+            }
+
+            TAsyncFd(const TAsyncFd&) = delete;
+            TAsyncFd(TAsyncFd&&) = delete;
+
+            ~TAsyncFd() {
+                if (Destroyed) {
+                    *Destroyed = true;
+                }
+
+                Loop.RemoveEvent(*this);
+
+                if (Own) {
+                    close(EvIdent);
+                }
+            }
+
+            TLoop& GetLoop() const {
+                return Loop;
+            }
+
+            int Fd() const {
+                return EvIdent;
+            }
+
+            void Cb(int filter, int flags) override {
+                const bool read = ((filter & MUHEV_FILTER_READ) || (flags & (MUHEV_FLAG_EOF | MUHEV_FLAG_ERROR)));
+                const bool write = ((filter & MUHEV_FILTER_WRITE) || (flags & MUHEV_FLAG_ERROR));
+
+                if (read) {
+                    ReadReady = true;
+                }
+
+                if (write) {
+                    WriteReady = true;
+                }
+
+                // A resumed coroutine may destroy this (e.g. if it lives in
+                // its frame)
+                bool destroyed = false;
+                Destroyed = &destroyed;
+
+                if (read && Reader && Reader->Try()) {
+                    Reader->Resume();
+
+                    if (destroyed) {
+                        return;
+                    }
+                }
+
+                if (write && Writer && Writer->Try()) {
+                    Writer->Resume();
+
+                    if (destroyed) {
+                        return;
+                    }
+                }
+
+                Destroyed = nullptr;
+            }
+
+            // Readiness is edge-triggered: these complete right away until
+            // an operation on the fd hits EAGAIN, call WouldBlock() after
+            // raw read()/write() calls that do
+            TIoAwaiter Readable(uint64_t timeoutMs = 0) {
+                return TIoAwaiter(*this, TIoAwaiter::OP_READABLE, nullptr, 0, timeoutMs);
+            }
+
+            TIoAwaiter Writable(uint64_t timeoutMs = 0) {
+                return TIoAwaiter(*this, TIoAwaiter::OP_WRITABLE, nullptr, 0, timeoutMs);
+            }
+
+            void WouldBlock(int filter) {
+                if (filter & MUHEV_FILTER_READ) {
+                    ReadReady = false;
+                }
+
+                if (filter & MUHEV_FILTER_WRITE) {
+                    WriteReady = false;
+                }
+            }
+
+            // Up to size bytes, 0 on EOF
+            TIoAwaiter Read(char* data, size_t size, uint64_t timeoutMs = 0) {
+                return TIoAwaiter(*this, TIoAwaiter::OP_READ, data, size, timeoutMs);
+            }
+
+            // All size bytes unless there is an error
+            TIoAwaiter Write(const char* data, size_t size, uint64_t timeoutMs = 0) {
+                return TIoAwaiter(*this, TIoAwaiter::OP_WRITE, (char*)data, size, timeoutMs);
+            }
+
+            // Non-blocking connection fd
+            TIoAwaiter Accept(uint64_t timeoutMs = 0) {
+                return TIoAwaiter(*this, TIoAwaiter::OP_ACCEPT, nullptr, 0, timeoutMs);
+            }
+
+        private:
+            friend class TIoAwaiter;
+
+            TLoop& Loop;
+            bool Own;
+            bool ReadReady = true;
+            bool WriteReady = true;
+            TIoAwaiter* Reader = nullptr;
+            TIoAwaiter* Writer = nullptr;
+            bool* Destroyed = nullptr;
+        };
+
+        class TSleepAwaiter : public TTimer {
+        public:
+            TSleepAwaiter(TLoop& loop, uint64_t delayMs)
+                : Loop(loop)
+                , DelayMs(delayMs)
+            {
+            }
+
+            bool await_ready() const {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) {
+                Handle = handle;
+                Loop.Schedule(*this, DelayMs);
+            }
+
+            void await_resume() const {
+            }
+
+            void Cb() override {
+                Handle.resume();
+            }
+
+        private:
+            TLoop& Loop;
+            uint64_t DelayMs;
+            std::coroutine_handle<> Handle;
+        };
+
+        static inline TSleepAwaiter Sleep(TLoop& loop, uint64_t delayMs) {
+            return TSleepAwaiter(loop, delayMs);
+        }
+
+        // Continues the coroutine on loop's thread, from any thread
+        struct TResumeOn {
+            TLoop& Loop;
+
+            bool await_ready() const {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) {
+                Loop.Post([handle]() {
+                    handle.resume();
+                });
+            }
+
+            void await_resume() const {
+            }
+        };
+
+        static inline TResumeOn ResumeOn(TLoop& loop) {
+            return TResumeOn{loop};
+        }
+
+        namespace NCoroPrivate {
+            static inline TLoop* LoopOf(TAsyncFd& fd) {
+                return &fd.GetLoop();
+            }
+        }
+
+        inline bool TIoAwaiter::Try() {
+            bool& ready = (IsWrite() ? Fd.WriteReady : Fd.ReadReady);
+
+            if (!ready) {
+                return false;
+            }
+
+            while (true) {
+                ssize_t rv = 0;
+
+                switch (Op) {
+                    case OP_READABLE:
+                    case OP_WRITABLE:
+                        Result = 1;
+                        return true;
+
+                    case OP_READ:
+                        rv = read(Fd.Fd(), Data, Size);
+                        break;
+
+                    case OP_WRITE:
+                        if (Done == Size) {
+                            Result = Done;
+                            return true;
+                        }
+
+#ifdef MSG_NOSIGNAL
+                        rv = send(Fd.Fd(), Data + Done, Size - Done, MSG_NOSIGNAL);
+
+                        if ((rv == -1) && (errno == ENOTSOCK)) {
+                            rv = write(Fd.Fd(), Data + Done, Size - Done);
+                        }
+#else
+                        rv = write(Fd.Fd(), Data + Done, Size - Done);
+#endif
+                        break;
+
+                    case OP_ACCEPT:
+#ifdef __linux__
+                        rv = accept4(Fd.Fd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+                        rv = accept(Fd.Fd(), nullptr, nullptr);
+
+                        if ((rv != -1) && !NSocketUtils::SetNonBlocking(rv)) {
+                            close(rv);
+                            continue;
+                        }
+#endif
+                        break;
+                }
+
+                if (rv >= 0) {
+                    if (Op == OP_WRITE) {
+                        Done += rv;
+                        continue;
+                    }
+
+                    Result = rv;
+                    return true;
+                }
+
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                    ready = false;
+                    return false;
+                }
+
+                if ((Op == OP_ACCEPT) && (errno == ECONNABORTED)) {
+                    continue;
+                }
+
+                Result = -1;
+                Error = errno;
+
+                return true;
+            }
+        }
+
+        inline void TIoAwaiter::await_suspend(std::coroutine_handle<> handle) {
+            TIoAwaiter*& slot = (IsWrite() ? Fd.Writer : Fd.Reader);
+
+            if (slot) {
+                throw std::logic_error("Concurrent awaiters on one TAsyncFd side");
+            }
+
+            slot = this;
+            Handle = handle;
+
+            if (TimeoutMs > 0) {
+                Fd.GetLoop().Schedule(Timeout, TimeoutMs);
+            }
+        }
+
+        inline void TIoAwaiter::Resume() {
+            (IsWrite() ? Fd.Writer : Fd.Reader) = nullptr;
+            Timeout.Cancel();
+
+            Handle.resume();
+        }
+
+        inline void TIoAwaiter::OnTimeout() {
+            Result = -1;
+            Error = ETIMEDOUT;
+
+            Resume();
+        }
+    }
+}
+
+#endif
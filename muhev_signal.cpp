@@ -0,0 +1,199 @@
+#include "muhev_signal.hpp"
+
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef __linux__
+    #include <sys/signalfd.h>
+
+#else
+    #include <sys/event.h>
+    #include <time.h>
+#endif
+
+#define SIGNAL_BATCH 32
+
+namespace NAC {
+    namespace NMuhEv {
+        namespace {
+            static bool MakeMask(const std::vector<int>& signals, sigset_t& mask) {
+                sigemptyset(&mask);
+
+                for (int signo : signals) {
+                    if (sigaddset(&mask, signo) != 0) {
+                        perror("sigaddset");
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+            // The mask only covers the calling thread, blocking here would
+            // leave the others with the default action
+            static void CheckBlocked(const std::vector<int>& signals) {
+                sigset_t current;
+                const int rv = pthread_sigmask(SIG_BLOCK, nullptr, &current);
+
+                if (rv != 0) {
+                    errno = rv;
+                    perror("pthread_sigmask");
+                    abort();
+                }
+
+                for (int signo : signals) {
+                    if (sigismember(&current, signo) != 1) {
+                        fprintf(stderr, "muhev: signal %d is not blocked, call BlockSignals() before starting threads\n", signo);
+                        abort();
+                    }
+                }
+            }
+
+            static int MakeSignalFd(const std::vector<int>& signals) {
+                CheckBlocked(signals);
+
+#ifdef __linux__
+                sigset_t mask;
+
+                if (!MakeMask(signals, mask)) {
+                    abort();
+                }
+
+                const int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+                if (fd == -1) {
+                    perror("signalfd");
+                    abort();
+                }
+
+                return fd;
+
+#else
+                // The loop watches this kqueue for readability
+                const int fd = kqueue();
+
+                if (fd == -1) {
+                    perror("kqueue");
+                    abort();
+                }
+
+                std::vector<struct kevent> changes(signals.size());
+
+                for (size_t i = 0; i < signals.size(); ++i) {
+                    EV_SET(&changes[i], signals[i], EVFILT_SIGNAL, EV_ADD | EV_ENABLE, 0, 0, 0);
+                }
+
+                while (kevent(fd, changes.data(), changes.size(), nullptr, 0, nullptr) != 0) {
+                    if (errno != EINTR) {
+                        perror("kevent");
+                        abort();
+                    }
+                }
+
+                return fd;
+#endif
+            }
+        }
+
+        bool BlockSignals(const std::vector<int>& signals) {
+            sigset_t mask;
+
+            if (!MakeMask(signals, mask)) {
+                return false;
+            }
+
+            const int rv = pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+            if (rv != 0) {
+                errno = rv;
+                perror("pthread_sigmask");
+                return false;
+            }
+
+            return true;
+        }
+
+        TSignalNode::TSignalNode(TLoop& loop, const std::vector<int>& signals)
+            : TNode(MakeSignalFd(signals), MUHEV_FILTER_READ)
+            , Loop(loop)
+        {
+            Batch.reserve(SIGNAL_BATCH);
+            Loop.AddEvent(*this, /* mod = */false);
+        }
+
+        TSignalNode::~TSignalNode() {
+            Loop.RemoveEvent(*this);
+            close(EvIdent);
+        }
+
+        void TSignalNode::Cb(int, int) {
+            Batch.clear();
+
+            while (true) {
+#ifdef __linux__
+                struct signalfd_siginfo infos[SIGNAL_BATCH];
+                const ssize_t rv = read(EvIdent, infos, sizeof(infos));
+
+                if (rv == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+
+                    if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                        perror("read");
+                    }
+
+                    break;
+                }
+
+                const size_t count = (rv / sizeof(*infos));
+
+                for (size_t i = 0; i < count; ++i) {
+                    TSignalInfo info;
+                    info.Signo = infos[i].ssi_signo;
+                    info.Code = infos[i].ssi_code;
+                    info.Pid = infos[i].ssi_pid;
+                    info.Uid = infos[i].ssi_uid;
+                    info.Status = infos[i].ssi_status;
+
+                    Batch.emplace_back(info);
+                }
+
+#else
+                struct kevent events[SIGNAL_BATCH];
+                const struct timespec zero = { 0, 0 };
+                const int count = kevent(EvIdent, nullptr, 0, events, SIGNAL_BATCH, &zero);
+
+                if (count == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+
+                    perror("kevent");
+                    break;
+                }
+
+                for (int i = 0; i < count; ++i) {
+                    TSignalInfo info;
+                    info.Signo = events[i].ident;
+                    info.Count = events[i].data;
+
+                    Batch.emplace_back(info);
+                }
+#endif
+
+                if (count < SIGNAL_BATCH) {
+                    break;
+                }
+            }
+
+            if (!Batch.empty()) {
+                OnSignals(Batch);
+            }
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "muhev.hpp"
+#include <memory>
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include <sys/types.h>
+
+namespace NAC {
+    namespace NMuhEv {
+        struct TSignalInfo {
+            int Signo = 0;
+            int Code = 0;
+            pid_t Pid = 0;
+            uid_t Uid = 0;
+            int Status = 0;
+            // Deliveries merged into this one (kqueue reports only counts)
+            size_t Count = 1;
+        };
+
+        // Blocks signals in the calling thread. Call it before starting
+        // any other threads, so that they inherit the mask and the signals
+        // can only arrive through TSignalNode.
+        bool BlockSignals(const std::vector<int>& signals);
+
+        // Delivers blocked signals as ordinary events of the loop it is
+        // registered with (signalfd on Linux, a private kqueue with
+        // EVFILT_SIGNAL elsewhere). Give each signal one node, its loop is
+        // the one receiving it.
+        class TSignalNode : public TNode {
+        public:
+            // signals must be blocked already, in every thread (see
+            // BlockSignals()); aborts if they aren't in the calling one
+            TSignalNode(TLoop& loop, const std::vector<int>& signals);
+            TSignalNode(const TSignalNode&) = delete;
+            TSignalNode(TSignalNode&&) = delete;
+
+            ~TSignalNode();
+
+            void Cb(int filter, int flags) override;
+
+        protected:
+            // Everything that arrived since the last call, in order
+            virtual void OnSignals(const std::vector<TSignalInfo>& infos) = 0;
+
+        private:
+            TLoop& Loop;
+            std::vector<TSignalInfo> Batch;
+        };
+
+        template<typename TCb>
+        class TSignalNodeImpl : public TSignalNode {
+        public:
+            TSignalNodeImpl(TLoop& loop, const std::vector<int>& signals, TCb&& cb)
+                : TSignalNode(loop, signals)
+                , Cb_(std::forward<TCb>(cb))
+            {
+            }
+
+        protected:
+            void OnSignals(const std::vector<TSignalInfo>& infos) override {
+                Cb_(infos);
+            }
+
+        private:
+            typename std::decay<TCb>::type Cb_;
+        };
+
+        // cb(const std::vector<TSignalInfo>&) runs on loop's thread
+        template<typename TCb>
+        std::unique_ptr<TSignalNode> NewSignalNode(TLoop& loop, const std::vector<int>& signals, TCb&& cb) {
+            return std::unique_ptr<TSignalNode>(new TSignalNodeImpl<TCb>(loop, signals, std::forward<TCb>(cb)));
+        }
+    }
+}
@@ -0,0 +1,190 @@
+#include "muhev_stats.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <functional>
+#include <thread>
+
+#if defined(__GNUG__) || defined(__clang__)
+    #include <cxxabi.h>
+#endif
+
+namespace NAC {
+    namespace NMuhEv {
+        namespace {
+            static std::string TypeName(const std::type_info& type) {
+#if defined(__GNUG__) || defined(__clang__)
+                int status = 0;
+                char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+
+                if (demangled) {
+                    std::string out(demangled);
+                    free(demangled);
+
+                    return out;
+                }
+#endif
+
+                return type.name();
+            }
+
+            static std::atomic<uint64_t> NextStatsId{1};
+
+            // Callbacks of one type tend to come in runs
+            struct TLastType {
+                uint64_t StatsId = 0;
+                const std::type_info* Type = nullptr;
+                THistogram* Histogram = nullptr;
+            };
+
+            static thread_local TLastType LastType;
+        }
+
+        uint64_t THistogram::TSnapshot::Percentile(double p) const {
+            if (Count == 0) {
+                return 0;
+            }
+
+            uint64_t rank = (uint64_t)(p / 100 * Count);
+
+            if (rank >= Count) {
+                rank = Count - 1;
+            }
+
+            uint64_t seen = 0;
+
+            for (size_t i = 0; i < Counts.size(); ++i) {
+                seen += Counts[i];
+
+                if (seen > rank) {
+                    return THistogram::LowerBound(i);
+                }
+            }
+
+            return Max;
+        }
+
+        THistogram::TSnapshot THistogram::Snapshot() const {
+            TSnapshot out;
+            out.Counts.resize(BUCKETS);
+
+            // Count comes from the buckets so percentiles stay consistent
+            // while the writer keeps going
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                out.Counts[i] = Counts[i].load(std::memory_order_relaxed);
+                out.Count += out.Counts[i];
+            }
+
+            out.Sum = Sum.load(std::memory_order_relaxed);
+            out.Max = Max.load(std::memory_order_relaxed);
+
+            return out;
+        }
+
+        TLoopStats::TLoopStats()
+            : Id(NextStatsId.fetch_add(1, std::memory_order_relaxed))
+        {
+        }
+
+        TLoopStats::~TLoopStats() {
+            for (auto& slot : Types) {
+                delete slot.Histogram.load(std::memory_order_relaxed);
+            }
+        }
+
+        uint64_t TLoopStats::Now() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+
+            return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+        }
+
+        THistogram& TLoopStats::Find(const std::type_info& type) {
+            if ((LastType.StatsId == Id) && (LastType.Type == &type)) {
+                return *LastType.Histogram;
+            }
+
+            const size_t start = (std::hash<const void*>()(&type) % MAX_TYPES);
+            THistogram* out = &Other;
+
+            for (size_t i = 0; i < MAX_TYPES; ++i) {
+                TSlot& slot = Types[(start + i) % MAX_TYPES];
+                const std::type_info* current = slot.Type.load(std::memory_order_acquire);
+
+                if (!current) {
+                    THistogram* histogram = slot.Histogram.load(std::memory_order_acquire);
+
+                    // Slots are claimed by their histogram, the type is
+                    // published after it so readers never see a type
+                    // without one
+                    if (!histogram) {
+                        THistogram* fresh = new THistogram;
+
+                        if (slot.Histogram.compare_exchange_strong(histogram, fresh, std::memory_order_acq_rel)) {
+                            slot.Type.store(&type, std::memory_order_release);
+                            out = fresh;
+                            break;
+                        }
+
+                        delete fresh;
+                    }
+
+                    // Claimed by another writer, which is about to
+                    // publish its type
+                    while (!(current = slot.Type.load(std::memory_order_acquire))) {
+                        std::this_thread::yield();
+                    }
+                }
+
+                if (current == &type) {
+                    out = slot.Histogram.load(std::memory_order_acquire);
+                    break;
+                }
+            }
+
+            LastType.StatsId = Id;
+            LastType.Type = &type;
+            LastType.Histogram = out;
+
+            return *out;
+        }
+
+        void TLoopStats::Stall(const std::type_info& type, uint64_t ns) {
+            Inc(Stalls, 1);
+
+            fprintf(
+                stderr,
+                "muhev: %s callback stalled the loop for %llu us\n",
+                TypeName(type).c_str(),
+                (unsigned long long)(ns / 1000)
+            );
+        }
+
+        TLoopStats::TSnapshot TLoopStats::Snapshot() const {
+            TSnapshot out;
+            out.Waits = Waits.load(std::memory_order_relaxed);
+            out.Events = Events.load(std::memory_order_relaxed);
+            out.BlockedNs = BlockedNs.load(std::memory_order_relaxed);
+            out.CallbackNs = CallbackNs.load(std::memory_order_relaxed);
+            out.Stalls = Stalls.load(std::memory_order_relaxed);
+            out.EventsPerWait = EventsPerWait.Snapshot();
+
+            for (const auto& slot : Types) {
+                const std::type_info* type = slot.Type.load(std::memory_order_acquire);
+
+                if (type) {
+                    out.Callbacks.emplace_back(TypeName(*type), slot.Histogram.load(std::memory_order_relaxed)->Snapshot());
+                }
+            }
+
+            auto other = Other.Snapshot();
+
+            if (other.Count > 0) {
+                out.Callbacks.emplace_back("<other>", std::move(other));
+            }
+
+            return out;
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <typeinfo>
+
+namespace NAC {
+    namespace NMuhEv {
+        // Log-linear histogram: exact below 8, then 8 buckets per power of
+        // two (12.5% precision). Any number of writers and readers.
+        class THistogram {
+        public:
+            static const size_t SUB_BITS = 3;
+            static const size_t SUB = (1 << SUB_BITS);
+            static const size_t BUCKETS = ((64 - SUB_BITS + 1) * SUB);
+
+            struct TSnapshot {
+                uint64_t Count = 0;
+                uint64_t Sum = 0;
+                uint64_t Max = 0;
+                std::vector<uint64_t> Counts;
+
+                // Lower bound of the bucket holding the p-th percentile
+                uint64_t Percentile(double p) const;
+
+                double Mean() const {
+                    return (Count ? ((double)Sum / Count) : 0);
+                }
+            };
+
+        public:
+            THistogram() = default;
+            THistogram(const THistogram&) = delete;
+            THistogram(THistogram&&) = delete;
+
+            void Record(uint64_t value) {
+                Counts[Index(value)].fetch_add(1, std::memory_order_relaxed);
+                Count.fetch_add(1, std::memory_order_relaxed);
+                Sum.fetch_add(value, std::memory_order_relaxed);
+
+                uint64_t max = Max.load(std::memory_order_relaxed);
+
+                while ((value > max) && !Max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+                }
+            }
+
+            TSnapshot Snapshot() const;
+
+            static size_t Index(uint64_t value) {
+                if (value < SUB) {
+                    return value;
+                }
+
+                const size_t exp = (63 - __builtin_clzll(value));
+
+                return ((exp - SUB_BITS + 1) * SUB + ((value >> (exp - SUB_BITS)) & (SUB - 1)));
+            }
+
+            static uint64_t LowerBound(size_t index) {
+                if (index < SUB) {
+                    return index;
+                }
+
+                const size_t exp = (index / SUB + SUB_BITS - 1);
+
+                return ((uint64_t)(SUB + index % SUB) << (exp - SUB_BITS));
+            }
+
+        private:
+            std::atomic<uint64_t> Counts[BUCKETS] = {};
+            std::atomic<uint64_t> Count{0};
+            std::atomic<uint64_t> Sum{0};
+            std::atomic<uint64_t> Max{0};
+        };
+
+        // Per-loop counters, written by whichever thread waits on the loop
+        // and readable from anywhere through Snapshot()
+        class TLoopStats {
+        public:
+            // Callback histograms are kept for this many distinct types,
+            // the rest share one entry
+            static const size_t MAX_TYPES = 64;
+
+            struct TSnapshot {
+                uint64_t Waits = 0;
+                uint64_t Events = 0;
+                uint64_t BlockedNs = 0;
+                uint64_t CallbackNs = 0;
+                uint64_t Stalls = 0;
+                THistogram::TSnapshot EventsPerWait;
+                // Nanoseconds per call, by demangled type name
+                std::vector<std::pair<std::string, THistogram::TSnapshot>> Callbacks;
+            };
+
+        public:
+            TLoopStats();
+            TLoopStats(const TLoopStats&) = delete;
+            TLoopStats(TLoopStats&&) = delete;
+
+            ~TLoopStats();
+
+            // Callbacks running longer than this are reported to stderr,
+            // 0 turns reporting off
+            void SetStallThreshold(uint64_t us) {
+                StallThresholdNs.store(us * 1000, std::memory_order_relaxed);
+            }
+
+            void RecordWait(uint64_t blockedNs, size_t events) {
+                Inc(Waits, 1);
+                Inc(Events, events);
+                Inc(BlockedNs, blockedNs);
+                EventsPerWait.Record(events);
+            }
+
+            void RecordCallback(const std::type_info& type, uint64_t ns) {
+                Inc(CallbackNs, ns);
+                Find(type).Record(ns);
+
+                const uint64_t threshold = StallThresholdNs.load(std::memory_order_relaxed);
+
+                if ((threshold > 0) && (ns >= threshold)) {
+                    Stall(type, ns);
+                }
+            }
+
+            TSnapshot Snapshot() const;
+
+            // Monotonic nanoseconds
+            static uint64_t Now();
+
+        private:
+            static void Inc(std::atomic<uint64_t>& counter, uint64_t value) {
+                counter.fetch_add(value, std::memory_order_relaxed);
+            }
+
+            THistogram& Find(const std::type_info& type);
+            void Stall(const std::type_info& type, uint64_t ns);
+
+        private:
+            struct TSlot {
+                std::atomic<const std::type_info*> Type{nullptr};
+                std::atomic<THistogram*> Histogram{nullptr};
+            };
+
+            std::atomic<uint64_t> Waits{0};
+            std::atomic<uint64_t> Events{0};
+            std::atomic<uint64_t> BlockedNs{0};
+            std::atomic<uint64_t> CallbackNs{0};
+            std::atomic<uint64_t> Stalls{0};
+            std::atomic<uint64_t> StallThresholdNs{50 * 1000 * 1000};
+            THistogram EventsPerWait;
+            TSlot Types[MAX_TYPES];
+            THistogram Other;
+            // Tells apart instances for the per-thread cache of Find()
+            const uint64_t Id;
+        };
+    }
+}
@@ -0,0 +1,282 @@
+#include "muhev_timer.hpp"
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+namespace NAC {
+    namespace NMuhEv {
+        namespace {
+            // Distance from `from` to the first set bit at or after it,
+            // wrapping around, -1 if the bitmap is empty
+            template<size_t WORDS>
+            static inline int FindNextSet(const uint64_t (&bits)[WORDS], unsigned from) {
+                const unsigned total(WORDS * 64);
+                const unsigned bit(from % 64);
+                unsigned word(from / 64);
+                uint64_t value(bits[word] & (~(uint64_t)0 << bit));
+
+                for (size_t i = 0; i <= WORDS; ++i) {
+                    if (value) {
+                        const unsigned pos(word * 64 + __builtin_ctzll(value));
+
+                        return ((pos + total - from) % total);
+                    }
+
+                    word = ((word + 1) % WORDS);
+                    value = bits[word];
+
+                    if ((i + 1) == WORDS) {
+                        // Back at the first word, only the bits below `from`
+                        value &= (((uint64_t)1 << bit) - 1);
+                    }
+                }
+
+                return -1;
+            }
+        }
+
+        void TTimer::Cancel() {
+            if (Wheel) {
+                Wheel->Cancel(*this);
+            }
+        }
+
+        TTimerWheel::TTimerWheel()
+            : Now(Clock())
+        {
+        }
+
+        TTimerWheel::~TTimerWheel() {
+            for (auto& head : Slots) {
+                while (head) {
+                    head->Wheel = nullptr;
+                    Unlink(*head);
+                }
+            }
+        }
+
+        uint64_t TTimerWheel::Clock() {
+            struct timespec ts;
+
+            if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+                perror("clock_gettime");
+                abort();
+            }
+
+            return ((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+        }
+
+        void TTimerWheel::Schedule(TTimer& timer, uint64_t delay) {
+            if (timer.Wheel) {
+                timer.Wheel->Cancel(timer);
+            }
+
+            timer.Expiry = Clock() + delay;
+
+            if (timer.Expiry <= Now) {
+                timer.Expiry = Now + 1;
+            }
+
+            timer.Wheel = this;
+            ++Count;
+
+            Insert(timer);
+        }
+
+        void TTimerWheel::Cancel(TTimer& timer) {
+            if (timer.Wheel != this) {
+                return;
+            }
+
+            Unlink(timer);
+
+            timer.Wheel = nullptr;
+            --Count;
+        }
+
+        void TTimerWheel::Insert(TTimer& timer) {
+            const uint64_t diff(timer.Expiry - Now);
+            int level(0);
+
+            while ((level < (LEVELS - 1)) && (diff >= ((uint64_t)1 << (LEVEL_BITS * (level + 1))))) {
+                ++level;
+            }
+
+            int index;
+
+            if ((level == (LEVELS - 1)) && (diff >= ((uint64_t)1 << (LEVEL_BITS * LEVELS)))) {
+                // Park in the top slot that cascades last, gets reinserted
+                index = (((Now >> (LEVEL_BITS * level)) - 1) & (SLOTS - 1));
+
+            } else {
+                index = ((timer.Expiry >> (LEVEL_BITS * level)) & (SLOTS - 1));
+            }
+
+            const int slot(level * SLOTS + index);
+
+            Link(timer, &Slots[slot], slot);
+        }
+
+        void TTimerWheel::Link(TTimer& timer, TTimer** head, int slot) {
+            timer.Head = head;
+            timer.Slot = slot;
+            timer.Prev = nullptr;
+            timer.Next = *head;
+
+            if (*head) {
+                (*head)->Prev = &timer;
+
+            } else if (slot >= 0) {
+                Occupied[slot / SLOTS][(slot % SLOTS) / 64] |= ((uint64_t)1 << (slot % 64));
+            }
+
+            *head = &timer;
+        }
+
+        void TTimerWheel::Unlink(TTimer& timer) {
+            if (timer.Prev) {
+                timer.Prev->Next = timer.Next;
+
+            } else {
+                *timer.Head = timer.Next;
+            }
+
+            if (timer.Next) {
+                timer.Next->Prev = timer.Prev;
+            }
+
+            if ((timer.Slot >= 0) && !*timer.Head) {
+                Occupied[timer.Slot / SLOTS][(timer.Slot % SLOTS) / 64] &= ~((uint64_t)1 << (timer.Slot % 64));
+            }
+
+            timer.Head = nullptr;
+            timer.Prev = timer.Next = nullptr;
+            timer.Slot = -1;
+        }
+
+        void TTimerWheel::Cascade(int level, int index) {
+            TTimer* list(Slots[level * SLOTS + index]);
+
+            if (!list) {
+                return;
+            }
+
+            Slots[level * SLOTS + index] = nullptr;
+            Occupied[level][index / 64] &= ~((uint64_t)1 << (index % 64));
+
+            while (list) {
+                TTimer* timer(list);
+                list = timer->Next;
+
+                timer->Prev = timer->Next = nullptr;
+                Insert(*timer);
+            }
+        }
+
+        size_t TTimerWheel::Expire(int index) {
+            // Detach the slot first: callbacks may schedule or cancel any
+            // timer, including ones still waiting in this list
+            TTimer* pending(nullptr);
+            TTimer* list(Slots[index]);
+            size_t fired(0);
+
+            Slots[index] = nullptr;
+            Occupied[0][index / 64] &= ~((uint64_t)1 << (index % 64));
+
+            while (list) {
+                TTimer* timer(list);
+                list = timer->Next;
+                timer->Prev = nullptr;
+                Link(*timer, &pending, -1);
+            }
+
+            while (pending) {
+                TTimer* timer(pending);
+
+                Unlink(*timer);
+                timer->Wheel = nullptr;
+                --Count;
+                ++fired;
+
+                try {
+                    timer->Cb();
+
+                } catch (...) {
+                }
+            }
+
+            return fired;
+        }
+
+        uint64_t TTimerWheel::NextEventTick() const {
+            uint64_t out(UINT64_MAX);
+
+            {
+                const int distance(FindNextSet(Occupied[0], (Now + 1) & (SLOTS - 1)));
+
+                if (distance >= 0) {
+                    out = Now + 1 + distance;
+                }
+            }
+
+            // A level N slot is due when the level N - 1 index wraps into it
+            for (int level = 1; level < LEVELS; ++level) {
+                const int shift(LEVEL_BITS * level);
+                const uint64_t next((Now >> shift) + 1);
+                const int distance(FindNextSet(Occupied[level], next & (SLOTS - 1)));
+
+                if (distance >= 0) {
+                    out = std::min(out, (next + distance) << shift);
+                }
+            }
+
+            return out;
+        }
+
+        size_t TTimerWheel::Advance(uint64_t now) {
+            size_t fired(0);
+
+            while (Now < now) {
+                if (Count == 0) {
+                    Now = now;
+                    break;
+                }
+
+                const uint64_t next(NextEventTick());
+
+                if (next > now) {
+                    Now = now;
+                    break;
+                }
+
+                Now = next;
+
+                const int index(Now & (SLOTS - 1));
+
+                for (int level = 1; level < LEVELS; ++level) {
+                    if ((Now & (((uint64_t)1 << (LEVEL_BITS * level)) - 1)) != 0) {
+                        break;
+                    }
+
+                    Cascade(level, (Now >> (LEVEL_BITS * level)) & (SLOTS - 1));
+                }
+
+                fired += Expire(index);
+            }
+
+            return fired;
+        }
+
+        int64_t TTimerWheel::NextTimeout(uint64_t now) const {
+            if (Count == 0) {
+                return -1;
+            }
+
+            const uint64_t next(NextEventTick());
+
+            return ((next > now) ? (int64_t)(next - now) : 0);
+        }
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <stddef.h>
+#include <utility>
+
+namespace NAC {
+    namespace NMuhEv {
+        class TTimerWheel;
+
+        // Intrusive timer, owned by the caller. Scheduling and cancelling
+        // are O(1) and don't allocate; must be used from the loop thread.
+        class TTimer {
+        public:
+            TTimer() = default;
+            TTimer(const TTimer&) = delete;
+            TTimer(TTimer&&) = delete;
+
+            virtual ~TTimer() {
+                Cancel();
+            }
+
+            virtual void Cb() = 0;
+
+            bool IsScheduled() const {
+                return (bool)Wheel;
+            }
+
+            // Monotonic milliseconds, see TTimerWheel::Clock()
+            uint64_t GetExpiry() const {
+                return Expiry;
+            }
+
+            void Cancel();
+
+        private:
+            friend class TTimerWheel;
+
+            TTimerWheel* Wheel = nullptr;
+            TTimer** Head = nullptr;
+            TTimer* Prev = nullptr;
+            TTimer* Next = nullptr;
+            uint64_t Expiry = 0;
+            int Slot = -1;
+        };
+
+        template<typename TCb>
+        class TTimerNode : public TTimer {
+        public:
+            TTimerNode(TCb&& cb)
+                : Cb_(std::forward<TCb>(cb))
+            {
+            }
+
+            void Cb() override {
+                Cb_();
+            }
+
+        private:
+            TCb Cb_;
+        };
+
+        // Hierarchical timing wheel: 4 levels of 256 slots, 1 ms ticks at
+        // the bottom, so level N slots are 256^N ms wide. Timers further
+        // than 2^32 ms away wait in the top level and get reinserted.
+        class TTimerWheel {
+        public:
+            TTimerWheel();
+            TTimerWheel(const TTimerWheel&) = delete;
+
+            ~TTimerWheel();
+
+            // Monotonic milliseconds
+            static uint64_t Clock();
+
+            // (Re)schedules timer to fire delay ms from now
+            void Schedule(TTimer& timer, uint64_t delay);
+            void Cancel(TTimer& timer);
+
+            // Fires every timer due at or before now, returns their count
+            size_t Advance(uint64_t now);
+
+            size_t Advance() {
+                return Advance(Clock());
+            }
+
+            // Milliseconds from now until the wheel needs Advance(),
+            // -1 if there are no timers
+            int64_t NextTimeout(uint64_t now) const;
+
+            int64_t NextTimeout() const {
+                return NextTimeout(Clock());
+            }
+
+            size_t Size() const {
+                return Count;
+            }
+
+        private:
+            static const int LEVELS = 4;
+            static const int LEVEL_BITS = 8;
+            static const int SLOTS = (1 << LEVEL_BITS);
+            static const int WORDS = SLOTS / 64;
+
+        private:
+            void Insert(TTimer& timer);
+            void Link(TTimer& timer, TTimer** head, int slot);
+            void Unlink(TTimer& timer);
+            void Cascade(int level, int index);
+            size_t Expire(int index);
+            uint64_t NextEventTick() const;
+
+        private:
+            uint64_t Now;
+            size_t Count = 0;
+            TTimer* Slots[LEVELS * SLOTS] = { nullptr };
+            uint64_t Occupied[LEVELS][WORDS] = { { 0 } };
+        };
+    }
+}
@@ -0,0 +1,161 @@
+#include "muhev_trigger_set.hpp"
+#include "muhev.hpp"
+
+#include <stdexcept>
+
+namespace NAC {
+    namespace NMuhEv {
+        TTriggerSet::~TTriggerSet() {
+            for (auto& segment : Segments) {
+                delete segment.load(std::memory_order_relaxed);
+            }
+        }
+
+        size_t TTriggerSet::Register(TLightTrigger* trigger) {
+            size_t index = 0;
+
+            {
+                NUtils::TSpinLockGuard guard(Lock);
+
+                if (Free.empty()) {
+                    if (Next == (MAX_SEGMENTS * SEGMENT_SIZE)) {
+                        throw std::length_error("Too many light triggers");
+                    }
+
+                    index = Next++;
+
+                    if ((index % SEGMENT_SIZE) == 0) {
+                        Segments[index / SEGMENT_SIZE].store(new TSegment, std::memory_order_release);
+                    }
+
+                } else {
+                    index = Free.back();
+                    Free.pop_back();
+                }
+            }
+
+            Segments[index / SEGMENT_SIZE].load(std::memory_order_acquire)->Triggers[index % SEGMENT_SIZE].store(trigger, std::memory_order_release);
+            Size_.fetch_add(1, std::memory_order_relaxed);
+
+            return index;
+        }
+
+        void TTriggerSet::Release(size_t index) {
+            TSegment* segment = Segments[index / SEGMENT_SIZE].load(std::memory_order_acquire);
+            const size_t offset = (index % SEGMENT_SIZE);
+
+            segment->Triggers[offset].store(nullptr);
+
+            // Either a Run() starting from now on doesn't see the trigger,
+            // or it is counted here. On the running thread the callback
+            // destroys its own trigger or the call comes from outside Run()
+            const uint64_t started = RunsStarted.load();
+
+            if ((RunsFinished.load() < started) && (Runner.load() != std::this_thread::get_id())) {
+                while (RunsFinished.load() < started) {
+                    std::this_thread::yield();
+                }
+            }
+
+            // Summary bits left behind only cost an empty look
+            segment->Words[offset / 64].fetch_and(~(uint64_t(1) << (offset % 64)), std::memory_order_relaxed);
+
+            Size_.fetch_sub(1, std::memory_order_relaxed);
+
+            NUtils::TSpinLockGuard guard(Lock);
+            Free.push_back(index);
+        }
+
+        bool TTriggerSet::Fire(size_t index) {
+            const size_t segmentIndex = (index / SEGMENT_SIZE);
+            const size_t offset = (index % SEGMENT_SIZE);
+            TSegment* segment = Segments[segmentIndex].load(std::memory_order_acquire);
+
+            // Children are set before parents and collected after them,
+            // so a bit is never left without a path to it
+            const uint64_t bit = (uint64_t(1) << (offset % 64));
+            const uint64_t word = segment->Words[offset / 64].fetch_or(bit, std::memory_order_release);
+
+            // Whoever made the word non-empty has woken the loop or is
+            // about to, and collecting takes the whole word
+            if (word != 0) {
+                return false;
+            }
+
+            const uint64_t summaryBit = (uint64_t(1) << (offset / 64));
+            const uint64_t summary = segment->Summary.fetch_or(summaryBit, std::memory_order_release);
+
+            if (summary == 0) {
+                Top[segmentIndex / 64].fetch_or(uint64_t(1) << (segmentIndex % 64), std::memory_order_release);
+            }
+
+            return true;
+        }
+
+        bool TTriggerSet::HasFired() const {
+            for (const auto& word : Top) {
+                if (word.load() != 0) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        size_t TTriggerSet::Run() {
+            size_t out = 0;
+
+            // Restored on return: callbacks may Wait() on the loop again
+            const std::thread::id prevRunner = Runner.exchange(std::this_thread::get_id());
+            RunsStarted.fetch_add(1);
+
+            for (size_t i = 0; i < TOP_WORDS; ++i) {
+                if (Top[i].load(std::memory_order_relaxed) == 0) {
+                    continue;
+                }
+
+                uint64_t segments = Top[i].exchange(0, std::memory_order_acquire);
+
+                while (segments) {
+                    const size_t segmentIndex = (i * 64 + __builtin_ctzll(segments));
+                    segments &= (segments - 1);
+
+                    TSegment* segment = Segments[segmentIndex].load(std::memory_order_acquire);
+                    uint64_t words = segment->Summary.exchange(0, std::memory_order_acquire);
+
+                    while (words) {
+                        const size_t wordIndex = __builtin_ctzll(words);
+                        words &= (words - 1);
+
+                        uint64_t bits = segment->Words[wordIndex].exchange(0, std::memory_order_acquire);
+
+                        while (bits) {
+                            const size_t offset = (wordIndex * 64 + __builtin_ctzll(bits));
+                            bits &= (bits - 1);
+
+                            // Earlier callbacks may have destroyed it
+                            TLightTrigger* trigger = segment->Triggers[offset].load();
+
+                            if (!trigger) {
+                                continue;
+                            }
+
+                            ++out;
+
+                            try {
+                                trigger->Cb();
+
+                            } catch (...) {
+                            }
+                        }
+                    }
+                }
+            }
+
+            Runner.store(prevRunner);
+            RunsFinished.fetch_add(1);
+
+            return out;
+        }
+    }
+}
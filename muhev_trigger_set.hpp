@@ -0,0 +1,74 @@
+#pragma once
+
+#include "spin_lock.hpp"
+#include <atomic>
+#include <cstdint>
+#include <stddef.h>
+#include <vector>
+#include <thread>
+
+namespace NAC {
+    namespace NMuhEv {
+        class TLightTrigger;
+
+        // Fired flags of any number of light triggers sharing one wakeup:
+        // a bitmap with two summary levels above it, so firing is at most
+        // three atomic ORs and collecting costs O(fired), not O(size).
+        class TTriggerSet {
+        public:
+            static const size_t SEGMENT_SIZE = 4096;
+            static const size_t WORDS = (SEGMENT_SIZE / 64);
+            static const size_t TOP_WORDS = 16;
+            static const size_t MAX_SEGMENTS = (TOP_WORDS * 64);
+
+        public:
+            TTriggerSet() = default;
+            TTriggerSet(const TTriggerSet&) = delete;
+            TTriggerSet(TTriggerSet&&) = delete;
+
+            ~TTriggerSet();
+
+            // Thread-safe
+            size_t Register(TLightTrigger* trigger);
+            // Thread-safe. If another thread is inside Run(), waits for it
+            // to return: it may be calling the trigger's callback right
+            // now. Never runs the callback again afterwards.
+            void Release(size_t index);
+
+            // Thread-safe, true if the loop has to be woken up
+            bool Fire(size_t index);
+
+            // Sequentially consistent, so it can be used to re-check
+            // before sleeping
+            bool HasFired() const;
+
+            // Runs the callbacks of fired triggers, returns their number.
+            // One thread at a time.
+            size_t Run();
+
+            size_t Size() const {
+                return Size_.load(std::memory_order_relaxed);
+            }
+
+        private:
+            struct TSegment {
+                std::atomic<uint64_t> Summary{0};
+                std::atomic<uint64_t> Words[WORDS] = {};
+                std::atomic<TLightTrigger*> Triggers[SEGMENT_SIZE] = {};
+            };
+
+        private:
+            std::atomic<uint64_t> Top[TOP_WORDS] = {};
+            std::atomic<TSegment*> Segments[MAX_SEGMENTS] = {};
+            std::atomic<size_t> Size_{0};
+            // Thread inside Run(), if any, and Run() calls started and
+            // finished so far (they nest on that thread)
+            std::atomic<std::thread::id> Runner{std::thread::id()};
+            std::atomic<uint64_t> RunsStarted{0};
+            std::atomic<uint64_t> RunsFinished{0};
+            NUtils::TSpinLock Lock;
+            std::vector<size_t> Free;
+            size_t Next = 0;
+        };
+    }
+}
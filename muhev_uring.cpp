@@ -0,0 +1,529 @@
+#include "muhev_uring.hpp"
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+namespace NAC {
+    namespace NMuhEv {
+        namespace {
+            // Completions of removals and cancellations carry no slot
+            static const uint64_t NO_TAG = 0;
+
+            static inline unsigned LoadAcquire(const unsigned* ptr) {
+                return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+            }
+
+            static inline void StoreRelease(unsigned* ptr, unsigned value) {
+                __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+            }
+
+            static inline void* Map(int fd, size_t size, off_t offset) {
+                void* out = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+
+                return ((out == MAP_FAILED) ? nullptr : out);
+            }
+        }
+
+        TUring::~TUring() {
+            if (BufData) {
+                munmap(BufData, RECV_BUFFERS * RECV_BUFFER_SIZE);
+            }
+
+            if (Sqes) {
+                munmap(Sqes, SqesSize);
+            }
+
+            if (CqMem && (CqMem != SqMem)) {
+                munmap(CqMem, CqMemSize);
+            }
+
+            if (SqMem) {
+                munmap(SqMem, SqMemSize);
+            }
+
+            if (Fd != -1) {
+                close(Fd);
+            }
+        }
+
+        bool TUring::Init(unsigned entries) {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            params.flags = IORING_SETUP_CQSIZE;
+            params.cq_entries = entries * 8;
+
+            Fd = syscall(__NR_io_uring_setup, entries, &params);
+
+            if (Fd == -1) {
+                return false;
+            }
+
+            if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+                return false;
+            }
+
+            SqMemSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            CqMemSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+            if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                SqMemSize = CqMemSize = std::max(SqMemSize, CqMemSize);
+            }
+
+            SqMem = Map(Fd, SqMemSize, IORING_OFF_SQ_RING);
+
+            if (!SqMem) {
+                perror("mmap");
+                return false;
+            }
+
+            if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                CqMem = SqMem;
+
+            } else {
+                CqMem = Map(Fd, CqMemSize, IORING_OFF_CQ_RING);
+
+                if (!CqMem) {
+                    perror("mmap");
+                    return false;
+                }
+            }
+
+            SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            Sqes = (io_uring_sqe*)Map(Fd, SqesSize, IORING_OFF_SQES);
+
+            if (!Sqes) {
+                perror("mmap");
+                return false;
+            }
+
+            char* sq = (char*)SqMem;
+            SqHead = (unsigned*)(sq + params.sq_off.head);
+            SqTail = (unsigned*)(sq + params.sq_off.tail);
+            SqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+            SqEntries = params.sq_entries;
+            SqLocalTail = *SqTail;
+
+            // Entries are always used in ring order
+            unsigned* array = (unsigned*)(sq + params.sq_off.array);
+
+            for (unsigned i = 0; i < SqEntries; ++i) {
+                array[i] = i;
+            }
+
+            char* cq = (char*)CqMem;
+            CqHead = (unsigned*)(cq + params.cq_off.head);
+            CqTail = (unsigned*)(cq + params.cq_off.tail);
+            CqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+            Cqes = (cq + params.cq_off.cqes);
+
+            // Handed over with IORING_OP_PROVIDE_BUFFERS: registered buffer
+            // rings (5.19) would save an SQE per recycled buffer, but they
+            // aren't dependable on every kernel that has them
+            void* data = mmap(nullptr, RECV_BUFFERS * RECV_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (data != MAP_FAILED) {
+                BufData = (char*)data;
+                Provide(0, RECV_BUFFERS);
+            }
+
+            return true;
+        }
+
+        unsigned TUring::Unsubmitted() const {
+            return (SqLocalTail - LoadAcquire(SqHead));
+        }
+
+        io_uring_sqe* TUring::Sqe() {
+            while (Unsubmitted() >= SqEntries) {
+                if ((Enter(Unsubmitted(), 0, 0) < 0) && (errno != EINTR) && (errno != EBUSY) && (errno != EAGAIN)) {
+                    perror("io_uring_enter");
+                    abort();
+                }
+            }
+
+            io_uring_sqe* out = &Sqes[SqLocalTail & SqMask];
+            memset(out, 0, sizeof(*out));
+
+            return out;
+        }
+
+        int TUring::Enter(unsigned submit, unsigned wait, int64_t timeoutMs) {
+            if (wait == 0) {
+                return syscall(__NR_io_uring_enter, Fd, submit, 0, IORING_ENTER_GETEVENTS, nullptr, 0);
+            }
+
+            __kernel_timespec ts;
+            ts.tv_sec = timeoutMs / 1000;
+            ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+
+            io_uring_getevents_arg arg;
+            memset(&arg, 0, sizeof(arg));
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = (uint64_t)&ts;
+
+            return syscall(
+                __NR_io_uring_enter,
+                Fd,
+                submit,
+                wait,
+                IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                &arg,
+                sizeof(arg)
+            );
+        }
+
+        uint64_t TUring::Tag(int slot) const {
+            return (((uint64_t)Slots[slot].Gen << 32) | (uint64_t)(slot + 1));
+        }
+
+        int TUring::AllocSlot() {
+            if (FreeSlots.empty()) {
+                Slots.emplace_back();
+
+                return (Slots.size() - 1);
+            }
+
+            const int out = FreeSlots.back();
+            FreeSlots.pop_back();
+
+            return out;
+        }
+
+        void TUring::FreeSlot(int slot) {
+            TSlot& it = Slots[slot];
+            const uint32_t gen = it.Gen;
+
+            // Late completions of the old owner won't match anymore
+            it = TSlot();
+            it.Gen = gen + 1;
+
+            FreeSlots.push_back(slot);
+        }
+
+        void TUring::QueuePoll(int slot) {
+            TSlot& it = Slots[slot];
+            io_uring_sqe* sqe = Sqe();
+
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = it.Node->GetEvIdent();
+            sqe->poll32_events = it.Mask;
+            sqe->len = (it.Multishot ? IORING_POLL_ADD_MULTI : 0);
+            sqe->user_data = Tag(slot);
+
+            StoreRelease(SqTail, ++SqLocalTail);
+            it.Armed = true;
+        }
+
+        void TUring::QueueCancel(uint8_t opcode, int slot) {
+            io_uring_sqe* sqe = Sqe();
+
+            sqe->opcode = opcode;
+            sqe->fd = -1;
+            sqe->addr = Tag(slot);
+            sqe->user_data = NO_TAG;
+
+            StoreRelease(SqTail, ++SqLocalTail);
+        }
+
+        int TUring::Arm(TNode& node, int slot) {
+            NUtils::TSpinLockGuard guard(Lock);
+
+            if (slot < 0) {
+                slot = AllocSlot();
+
+            } else if (Slots[slot].Armed) {
+                QueueCancel(IORING_OP_POLL_REMOVE, slot);
+                ++Slots[slot].Gen;
+            }
+
+            TSlot& it = Slots[slot];
+            it.Node = &node;
+            it.Mask = 0;
+
+            if (node.GetEvFilter() & MUHEV_FILTER_READ) {
+                it.Mask |= (EPOLLIN | EPOLLRDHUP);
+            }
+
+            if (node.GetEvFilter() & MUHEV_FILTER_WRITE) {
+                it.Mask |= EPOLLOUT;
+            }
+
+            // Multishot polls report wakeups, which is what edge-triggered
+            // means; level-triggered ones are re-armed after each event
+            // and complete again right away while the fd stays ready
+            it.Multishot = ((node.GetEvFlags() & MUHEV_FLAG_EDGE) && !(node.GetEvFlags() & MUHEV_FLAG_ONESHOT));
+            it.Rearm = !(node.GetEvFlags() & MUHEV_FLAG_ONESHOT);
+
+            QueuePoll(slot);
+
+            return slot;
+        }
+
+        void TUring::Disarm(int slot) {
+            if (slot < 0) {
+                return;
+            }
+
+            NUtils::TSpinLockGuard guard(Lock);
+
+            if (Slots[slot].Armed) {
+                QueueCancel(IORING_OP_POLL_REMOVE, slot);
+            }
+
+            FreeSlot(slot);
+        }
+
+        void TUring::Submit() {
+            NUtils::TSpinLockGuard guard(Lock);
+            const unsigned count = Unsubmitted();
+
+            if ((count > 0) && (Enter(count, 0, 0) < 0) && (errno != EINTR) && (errno != EBUSY) && (errno != EAGAIN)) {
+                perror("io_uring_enter");
+                abort();
+            }
+        }
+
+        int TUring::Wait(TInternalEvStruct* list, size_t capacity, int64_t timeoutMs) {
+            unsigned count = 0;
+            bool ready = false;
+
+            {
+                NUtils::TSpinLockGuard guard(Lock);
+                count = Unsubmitted();
+                ready = (LoadAcquire(CqTail) != *CqHead);
+            }
+
+            // Neither anything to hand over nor a reason to wait
+            if ((count > 0) || !ready) {
+                const int rv = Enter(count, ((ready || (timeoutMs == 0)) ? 0 : 1), timeoutMs);
+
+                if ((rv < 0) && (errno != ETIME) && (errno != EBUSY) && (errno != EAGAIN)) {
+                    return -1;
+                }
+            }
+
+            NUtils::TSpinLockGuard guard(Lock);
+            unsigned head = *CqHead;
+            const unsigned tail = LoadAcquire(CqTail);
+            size_t out = 0;
+
+            while ((head != tail) && (out < capacity)) {
+                const io_uring_cqe& cqe = ((const io_uring_cqe*)Cqes)[head & CqMask];
+                const bool more = (cqe.flags & IORING_CQE_F_MORE);
+                const int buffer = ((cqe.flags & IORING_CQE_F_BUFFER) ? (int)(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1);
+                const uint64_t slot = ((cqe.user_data & 0xffffffff) - 1);
+
+                ++head;
+
+                if (
+                    (cqe.user_data == NO_TAG)
+                    || (slot >= Slots.size())
+                    || (Slots[slot].Gen != (uint32_t)(cqe.user_data >> 32))
+                ) {
+                    if (buffer >= 0) {
+                        Provide(buffer, 1);
+                    }
+
+                    continue;
+                }
+
+                TSlot& it = Slots[slot];
+
+                if (it.Op) {
+                    TUringOp* op = it.Op;
+                    op->Results.push_back(TUringOp::TResult{cqe.res, buffer});
+
+                    if (!more) {
+                        op->Slot = -1;
+                        FreeSlot(slot);
+                    }
+
+                    list[out].events = 0;
+                    list[out].data.ptr = (void*)op;
+                    ++out;
+
+                    continue;
+                }
+
+                if (cqe.res == -ECANCELED) {
+                    it.Armed = false;
+                    continue;
+                }
+
+                list[out].events = ((cqe.res < 0) ? (uint32_t)EPOLLERR : (uint32_t)cqe.res);
+                list[out].data.ptr = (void*)it.Node;
+                ++out;
+
+                if (!more) {
+                    it.Armed = false;
+
+                    // Goes out with the next submission, after the
+                    // callbacks for this one have run
+                    if (it.Rearm && (cqe.res >= 0)) {
+                        QueuePoll(slot);
+                    }
+                }
+            }
+
+            StoreRelease(CqHead, head);
+
+            return out;
+        }
+
+        int TUring::StartOp(TUringOp& op, uint8_t opcode, int fd, const void* data, size_t size, int64_t offset) {
+            NUtils::TSpinLockGuard guard(Lock);
+            const int slot = AllocSlot();
+
+            Slots[slot].Node = &op;
+            Slots[slot].Op = &op;
+
+            io_uring_sqe* sqe = Sqe();
+            sqe->opcode = opcode;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)data;
+            sqe->len = size;
+            sqe->off = (uint64_t)offset;
+            sqe->user_data = Tag(slot);
+
+            if (opcode == IORING_OP_RECV) {
+                sqe->ioprio = IORING_RECV_MULTISHOT;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = 0;
+            }
+
+            StoreRelease(SqTail, ++SqLocalTail);
+
+            return slot;
+        }
+
+        void TUring::CancelOp(int slot) {
+            NUtils::TSpinLockGuard guard(Lock);
+
+            QueueCancel(IORING_OP_ASYNC_CANCEL, slot);
+            FreeSlot(slot);
+        }
+
+        const char* TUring::RecvBuffer(int index) const {
+            return (BufData + (size_t)index * RECV_BUFFER_SIZE);
+        }
+
+        void TUring::Provide(int index, int count) {
+            io_uring_sqe* sqe = Sqe();
+
+            sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+            sqe->fd = count;
+            sqe->addr = (uint64_t)RecvBuffer(index);
+            sqe->len = RECV_BUFFER_SIZE;
+            sqe->off = index;
+            sqe->buf_group = 0;
+            sqe->user_data = NO_TAG;
+
+            StoreRelease(SqTail, ++SqLocalTail);
+        }
+
+        void TUring::Recycle(int index) {
+            NUtils::TSpinLockGuard guard(Lock);
+
+            Provide(index, 1);
+        }
+
+        TUringOp::TUringOp(TLoop& loop)
+            : TNode(-1)
+            , Uring(loop.GetUring())
+        {
+        }
+
+        TUringOp::~TUringOp() {
+            if (Destroyed) {
+                *Destroyed = true;
+            }
+
+            Cancel();
+
+            for (const auto& result : Results) {
+                if (result.Buffer >= 0) {
+                    Uring->Recycle(result.Buffer);
+                }
+            }
+        }
+
+        bool TUringOp::Read(int fd, void* data, size_t size, int64_t offset) {
+            if (!Uring || IsPending()) {
+                return false;
+            }
+
+            Slot = Uring->StartOp(*this, IORING_OP_READ, fd, data, size, offset);
+
+            return true;
+        }
+
+        bool TUringOp::Write(int fd, const void* data, size_t size, int64_t offset) {
+            if (!Uring || IsPending()) {
+                return false;
+            }
+
+            Slot = Uring->StartOp(*this, IORING_OP_WRITE, fd, data, size, offset);
+
+            return true;
+        }
+
+        bool TUringOp::Recv(int fd) {
+            if (!Uring || IsPending() || !Uring->HasRecvBuffers()) {
+                return false;
+            }
+
+            Slot = Uring->StartOp(*this, IORING_OP_RECV, fd, nullptr, 0, 0);
+
+            return true;
+        }
+
+        void TUringOp::Cancel() {
+            if (Slot >= 0) {
+                Uring->CancelOp(Slot);
+                Slot = -1;
+            }
+        }
+
+        void TUringOp::Cb(int, int) {
+            bool destroyed = false;
+            Destroyed = &destroyed;
+
+            // OnComplete() may start the next operation or destroy this
+            while (!Results.empty()) {
+                const TResult result = Results.front();
+                Results.pop_front();
+
+                TUring* uring = Uring;
+
+                try {
+                    OnComplete(result.Res, ((result.Buffer >= 0) ? uring->RecvBuffer(result.Buffer) : nullptr));
+
+                } catch (...) {
+                }
+
+                if (result.Buffer >= 0) {
+                    uring->Recycle(result.Buffer);
+                }
+
+                if (destroyed) {
+                    return;
+                }
+            }
+
+            Destroyed = nullptr;
+        }
+    }
+}
+
+#endif
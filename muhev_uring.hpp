@@ -0,0 +1,169 @@
+#pragma once
+
+#include "muhev.hpp"
+
+#ifdef __linux__
+
+#include "spin_lock.hpp"
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <stddef.h>
+
+struct io_uring_sqe;
+
+namespace NAC {
+    namespace NMuhEv {
+        class TUringOp;
+
+        // Raw io_uring (no liburing) behind TLoop(MUHEV_BACKEND_URING).
+        // Nodes are watched with poll requests: multishot for edge-triggered
+        // ones, single-shot and re-armed by the next submission for the rest.
+        // Completions are reported as epoll events so TLoop dispatches them
+        // the same way. One thread may Wait(), any may Arm()/Disarm().
+        class TUring {
+        public:
+            // Receive buffers handed to the kernel for TUringOp::Recv()
+            static const size_t RECV_BUFFERS = 512;
+            static const size_t RECV_BUFFER_SIZE = 4096;
+
+        public:
+            TUring() = default;
+            TUring(const TUring&) = delete;
+            TUring(TUring&&) = delete;
+
+            ~TUring();
+
+            // false if the kernel lacks io_uring or IORING_FEAT_EXT_ARG (5.11);
+            // TUringOp::Recv() also needs multishot receive (6.0)
+            bool Init(unsigned entries);
+
+            // (Re)starts polling node's filters, slot is the one returned
+            // earlier for it or -1
+            int Arm(TNode& node, int slot);
+            void Disarm(int slot);
+
+            // Hands queued requests to the kernel without waiting
+            void Submit();
+
+            // Submits, waits up to timeoutMs for completions and reaps up
+            // to capacity of them
+            int Wait(TInternalEvStruct* list, size_t capacity, int64_t timeoutMs);
+
+            bool HasRecvBuffers() const {
+                return (BufData != nullptr);
+            }
+
+        private:
+            friend class TUringOp;
+
+            struct TSlot {
+                TNode* Node = nullptr;
+                TUringOp* Op = nullptr;
+                uint32_t Gen = 0;
+                uint32_t Mask = 0;
+                bool Armed = false;
+                bool Multishot = false;
+                bool Rearm = false;
+            };
+
+        private:
+            io_uring_sqe* Sqe();
+            int Enter(unsigned submit, unsigned wait, int64_t timeoutMs);
+            unsigned Unsubmitted() const;
+            uint64_t Tag(int slot) const;
+            int AllocSlot();
+            void FreeSlot(int slot);
+            void QueuePoll(int slot);
+            void QueueCancel(uint8_t opcode, int slot);
+            int StartOp(TUringOp& op, uint8_t opcode, int fd, const void* data, size_t size, int64_t offset);
+            void CancelOp(int slot);
+            const char* RecvBuffer(int index) const;
+            void Provide(int index, int count);
+            void Recycle(int index);
+
+        private:
+            int Fd = -1;
+            NUtils::TSpinLock Lock;
+
+            void* SqMem = nullptr;
+            size_t SqMemSize = 0;
+            void* CqMem = nullptr;
+            size_t CqMemSize = 0;
+            io_uring_sqe* Sqes = nullptr;
+            size_t SqesSize = 0;
+
+            unsigned* SqHead = nullptr;
+            unsigned* SqTail = nullptr;
+            unsigned SqMask = 0;
+            unsigned SqEntries = 0;
+            unsigned SqLocalTail = 0;
+
+            unsigned* CqHead = nullptr;
+            unsigned* CqTail = nullptr;
+            unsigned CqMask = 0;
+            void* Cqes = nullptr;
+
+            std::vector<TSlot> Slots;
+            std::vector<int> FreeSlots;
+
+            char* BufData = nullptr;
+        };
+
+        // Completion-style operation on a loop using the io_uring backend,
+        // one at a time per object. Completions go through the loop's
+        // ready queue like readiness events and reach OnComplete() on the
+        // loop thread. Requests are submitted with the next Wait().
+        //
+        // Destroying the object or Cancel() cancels a pending operation,
+        // but the kernel may keep using a Read() or Write() buffer until
+        // the cancellation completes. Loop thread only.
+        class TUringOp : public TNode {
+        public:
+            TUringOp(TLoop& loop);
+            TUringOp(const TUringOp&) = delete;
+            TUringOp(TUringOp&&) = delete;
+
+            ~TUringOp();
+
+            void Cb(int filter, int flags) override;
+
+            // false if an operation is pending or the loop doesn't use
+            // io_uring; offset -1 is the current position (sockets, pipes)
+            bool Read(int fd, void* data, size_t size, int64_t offset = -1);
+            bool Write(int fd, const void* data, size_t size, int64_t offset = -1);
+
+            // Multishot receive into buffers owned by the loop: one
+            // OnComplete() per chunk until EOF (0), an error or Cancel().
+            // -ENOBUFS ends it when the loop runs out of buffers.
+            bool Recv(int fd);
+
+            void Cancel();
+
+            bool IsPending() const {
+                return (Slot >= 0);
+            }
+
+        protected:
+            // res is the syscall result or -errno; data is only set for
+            // Recv() chunks and only valid during the call
+            virtual void OnComplete(int res, const char* data) = 0;
+
+        private:
+            friend class TUring;
+
+            struct TResult {
+                int Res;
+                int Buffer;
+            };
+
+        private:
+            TUring* Uring;
+            int Slot = -1;
+            std::deque<TResult> Results;
+            bool* Destroyed = nullptr;
+        };
+    }
+}
+
+#endif
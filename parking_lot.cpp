@@ -0,0 +1,67 @@
+#include "parking_lot.hpp"
+
+#include <limits.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+    #include <unistd.h>
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+#endif
+
+namespace NAC {
+    namespace NUtils {
+        void TParkingLot::Park(uint32_t key) {
+#ifdef __linux__
+            while (Epoch.load(std::memory_order_acquire) == key) {
+                // Returns right away if Epoch has moved on meanwhile
+                const long rv = syscall(SYS_futex, (uint32_t*)&Epoch, FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+
+                if ((rv == -1) && (errno != EAGAIN) && (errno != EINTR)) {
+                    perror("futex");
+                    abort();
+                }
+            }
+
+#else
+            {
+                std::unique_lock<std::mutex> guard(Mutex);
+
+                while (Epoch.load(std::memory_order_acquire) == key) {
+                    Cond.wait(guard);
+                }
+            }
+#endif
+
+            Leave();
+        }
+
+        void TParkingLot::Unpark(bool all) {
+#ifdef __linux__
+            Epoch.fetch_add(1, std::memory_order_release);
+
+            if (syscall(SYS_futex, (uint32_t*)&Epoch, FUTEX_WAKE_PRIVATE, (all ? INT_MAX : 1), nullptr, nullptr, 0) == -1) {
+                perror("futex");
+                abort();
+            }
+
+#else
+            {
+                // Bumped under the lock so a Park() between its check and
+                // wait() can't miss it
+                std::lock_guard<std::mutex> guard(Mutex);
+                Epoch.fetch_add(1, std::memory_order_release);
+            }
+
+            if (all) {
+                Cond.notify_all();
+
+            } else {
+                Cond.notify_one();
+            }
+#endif
+        }
+    }
+}
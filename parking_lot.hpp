@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#ifndef __linux__
+    #include <mutex>
+    #include <condition_variable>
+#endif
+
+namespace NAC {
+    namespace NUtils {
+        // Where idle threads sleep until there is something for them to do
+        // (an event count). A futex on Linux, a condition variable elsewhere.
+        //
+        //     const uint32_t key = lot.Prepare();
+        //
+        //     if (HaveWork()) {
+        //         lot.Cancel();
+        //
+        //     } else {
+        //         lot.Park(key);
+        //     }
+        //
+        // Producers make the work visible and call Unpark*(): they are
+        // cheap when nobody is parked. An Unpark*() after Prepare() makes
+        // Park() return right away, so no wakeup is lost.
+        class TParkingLot {
+        public:
+            TParkingLot() = default;
+            TParkingLot(const TParkingLot&) = delete;
+            TParkingLot(TParkingLot&&) = delete;
+
+            uint32_t Prepare() {
+                Waiters.fetch_add(1);
+                return Epoch.load();
+            }
+
+            void Cancel() {
+                Leave();
+            }
+
+            void Park(uint32_t key);
+
+            // Does nothing while the thread woken by the previous call
+            // hasn't got up yet: a burst of work wakes one thread, which
+            // is expected to wake the next one if there is more left
+            void UnparkOne() {
+                // Pairs with Prepare(): either the producer sees the waiter
+                // or the waiter's re-check sees the work
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if ((Waiters.load() == 0) || Waking.exchange(true)) {
+                    return;
+                }
+
+                // Cleared by whoever leaves next, or here if nobody is
+                // left to do it
+                if (Waiters.load() == 0) {
+                    Waking.store(false);
+                    return;
+                }
+
+                Unpark(false);
+            }
+
+            void UnparkAll() {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (Waiters.load() > 0) {
+                    Unpark(true);
+                }
+            }
+
+        private:
+            void Unpark(bool all);
+
+            void Leave() {
+                Waiters.fetch_sub(1);
+                Waking.store(false);
+            }
+
+        private:
+            std::atomic<uint32_t> Epoch{0};
+            std::atomic<uint32_t> Waiters{0};
+            std::atomic<bool> Waking{false};
+#ifndef __linux__
+            std::mutex Mutex;
+            std::condition_variable Cond;
+#endif
+        };
+    }
+}
@@ -0,0 +1,415 @@
+#include "reactor_pool.hpp"
+#include "worker_lite.hpp"
+#include "utils/socket.hpp"
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdexcept>
+#include <vector>
+#include <pthread.h>
+
+#ifdef __linux__
+    #include <sched.h>
+#endif
+
+#define SWEEP_INTERVAL 100
+
+namespace NAC {
+    namespace NMuhEv {
+        namespace {
+            static thread_local int CurrentIndex_ = -1;
+
+            // CPUs this process may run on, empty if unknown
+            static std::vector<int> AllowedCpus() {
+                std::vector<int> out;
+
+#ifdef __linux__
+                cpu_set_t set;
+                CPU_ZERO(&set);
+
+                if (sched_getaffinity(0, sizeof(set), &set) == -1) {
+                    perror("sched_getaffinity");
+                    return out;
+                }
+
+                for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                    if (CPU_ISSET(cpu, &set)) {
+                        out.push_back(cpu);
+                    }
+                }
+#endif
+
+                return out;
+            }
+
+            // Closes the connection if the target loop exits before
+            // running the task
+            template<typename TTarget>
+            class TAdoptTask {
+            public:
+                TAdoptTask(TTarget* target, int fd)
+                    : Target(target)
+                    , Fd(fd)
+                {
+                }
+
+                TAdoptTask(TAdoptTask&& right)
+                    : Target(right.Target)
+                    , Fd(right.Fd)
+                {
+                    right.Fd = -1;
+                }
+
+                ~TAdoptTask() {
+                    if (Fd != -1) {
+                        close(Fd);
+                    }
+                }
+
+                void operator()() {
+                    const int fd = Fd;
+                    Fd = -1;
+
+                    Target->Adopt(fd);
+                }
+
+            private:
+                TTarget* Target;
+                int Fd;
+            };
+
+            class TAcceptNode : public TNode {
+            public:
+                TAcceptNode(int fd, std::function<void(int)>&& cb)
+                    : TNode(fd, MUHEV_FILTER_READ)
+                    , Cb_(std::move(cb))
+                {
+                }
+
+                ~TAcceptNode() {
+                    close(EvIdent);
+                }
+
+                void Cb(int, int) override {
+                    while (true) {
+#ifdef __linux__
+                        const int fd = accept4(EvIdent, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+                        const int fd = accept(EvIdent, nullptr, nullptr);
+#endif
+
+                        if (fd == -1) {
+                            if (errno == EINTR) {
+                                continue;
+                            }
+
+                            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ECONNABORTED)) {
+                                perror("accept");
+                            }
+
+                            break;
+                        }
+
+#ifndef __linux__
+                        if (!NSocketUtils::SetNonBlocking(fd)) {
+                            close(fd);
+                            continue;
+                        }
+#endif
+
+                        Cb_(fd);
+                    }
+                }
+
+            private:
+                std::function<void(int)> Cb_;
+            };
+        }
+
+        class TReactor : public NBase::TWorkerLite {
+        public:
+            TReactor(TReactorPool& pool, int index, int cpu)
+                : Pool(pool)
+                , Index(index)
+                , Cpu(cpu)
+                , SweepTimer(Loop.NewTimer([this]() {
+                    Sweep();
+                    Loop.Schedule(*SweepTimer, SWEEP_INTERVAL);
+                }))
+            {
+            }
+
+            ~TReactor() {
+                Join();
+            }
+
+            void SetListener(int fd) {
+                Listener.reset(new TAcceptNode(fd, [this](int fd) {
+                    Pool.Dispatch(*this, fd);
+                }));
+            }
+
+            void Run() override {
+                CurrentIndex_ = Index;
+
+#ifdef __linux__
+                if (Cpu >= 0) {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    CPU_SET(Cpu, &set);
+
+                    const int rv = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+                    if (rv != 0) {
+                        errno = rv;
+                        perror("pthread_setaffinity_np");
+                    }
+                }
+#endif
+
+                if (Listener) {
+                    Loop.AddEvent(*Listener, /* mod = */false);
+                }
+
+                Loop.Schedule(*SweepTimer, SWEEP_INTERVAL);
+
+                while (true) {
+                    if (Stopping) {
+                        Sweep();
+
+                        if (Connections.empty()) {
+                            break;
+                        }
+                    }
+
+                    if (!Loop.Wait()) {
+                        perror("wait");
+                        break;
+                    }
+                }
+
+                Drop();
+                Loop.Cancel(*SweepTimer);
+            }
+
+            // Called on the loop thread, fd has already been counted in Load
+            void Adopt(int fd) {
+                std::unique_ptr<TNode> node;
+
+                if (!Stopping) {
+                    try {
+                        node = Pool.Factory(Loop, fd);
+
+                    } catch (...) {
+                    }
+                }
+
+                if (!node) {
+                    close(fd);
+                    Load.fetch_sub(1, std::memory_order_relaxed);
+                    return;
+                }
+
+                Loop.AddEvent(*node, /* mod = */false);
+                Connections.emplace_back(std::move(node));
+            }
+
+            void Reserve() {
+                Load.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // Called on the loop thread
+            void BeginStop(uint64_t drainTimeoutMs) {
+                if (Stopping) {
+                    return;
+                }
+
+                Stopping = true;
+
+                if (Listener) {
+                    Loop.RemoveEvent(*Listener);
+                    Listener.reset();
+                }
+
+                if (drainTimeoutMs > 0) {
+                    Deadline = Loop.NewTimer([this]() {
+                        Drop();
+                    });
+
+                    Loop.Schedule(*Deadline, drainTimeoutMs);
+                }
+
+                // Wait() may have nothing else to return for
+                Loop.Wake();
+            }
+
+            size_t GetLoad() const {
+                return Load.load(std::memory_order_relaxed);
+            }
+
+        private:
+            // Dead nodes are expected to have closed their fds already,
+            // like with TLoop::WaitUntilComplete()
+            void Sweep() {
+                size_t alive = 0;
+
+                for (auto& node : Connections) {
+                    if (node->IsAlive()) {
+                        std::swap(Connections[alive++], node);
+                    }
+                }
+
+                Load.fetch_sub(Connections.size() - alive, std::memory_order_relaxed);
+                Connections.resize(alive);
+            }
+
+            void Drop() {
+                for (auto& node : Connections) {
+                    if (node->IsAlive()) {
+                        Loop.RemoveEvent(*node);
+                    }
+                }
+
+                Load.fetch_sub(Connections.size(), std::memory_order_relaxed);
+                Connections.clear();
+            }
+
+        public:
+            TLoop Loop;
+
+        private:
+            TReactorPool& Pool;
+            int Index;
+            int Cpu;
+            std::unique_ptr<TTimer> SweepTimer;
+            std::unique_ptr<TTimer> Deadline;
+            std::unique_ptr<TAcceptNode> Listener;
+            std::vector<std::unique_ptr<TNode>> Connections;
+            std::atomic<size_t> Load{0};
+            bool Stopping = false;
+        };
+
+        TReactorPool::TReactorPool(TFactory&& factory, size_t threads, EAcceptMode mode, bool pin)
+            : Factory(std::move(factory))
+            , Mode(mode)
+            , Pin(pin)
+        {
+            // Online CPUs may be outside of the affinity mask (taskset,
+            // cgroup cpusets)
+            const std::vector<int> cpus(AllowedCpus());
+
+            if (threads == 0) {
+                const long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+                threads = (!cpus.empty() ? cpus.size() : ((online > 0) ? online : 1));
+            }
+
+            for (size_t i = 0; i < threads; ++i) {
+                Reactors.emplace_back(new TReactor(*this, i, ((Pin && !cpus.empty()) ? cpus[i % cpus.size()] : -1)));
+                RoundRobin.emplace_back(Reactors.back().get());
+            }
+        }
+
+        TReactorPool::~TReactorPool() {
+            Stop(1);
+            Join();
+        }
+
+        bool TReactorPool::Listen(const std::string& host, unsigned short port, int backlog) {
+            if (Started) {
+                throw std::logic_error("Listen() must be called before Start()");
+            }
+
+            const size_t count((Mode == ACCEPT_REUSEPORT) ? Reactors.size() : 1);
+
+            for (size_t i = 0; i < count; ++i) {
+                const int fd = NSocketUtils::Listen(host, port, (Mode == ACCEPT_REUSEPORT), backlog);
+
+                if (fd == -1) {
+                    return false;
+                }
+
+                if (port == 0) {
+                    // The rest must share the port picked for the first one
+                    port = NSocketUtils::LocalPort(fd);
+                }
+
+                Reactors[i]->SetListener(fd);
+            }
+
+            Port_ = port;
+
+            return true;
+        }
+
+        void TReactorPool::Start() {
+            if (Started) {
+                return;
+            }
+
+            Started = true;
+
+            for (auto& reactor : Reactors) {
+                reactor->Start();
+            }
+        }
+
+        void TReactorPool::Stop(uint64_t drainTimeoutMs) {
+            for (auto& reactor : Reactors) {
+                TReactor* ptr = reactor.get();
+
+                reactor->Loop.Post([ptr, drainTimeoutMs]() {
+                    ptr->BeginStop(drainTimeoutMs);
+                });
+            }
+        }
+
+        void TReactorPool::Join() {
+            if (!Started) {
+                return;
+            }
+
+            for (auto& reactor : Reactors) {
+                reactor->Join();
+            }
+        }
+
+        TLoop& TReactorPool::GetLoop(size_t index) {
+            return Reactors.at(index)->Loop;
+        }
+
+        size_t TReactorPool::ConnectionCount(size_t index) const {
+            return Reactors.at(index)->GetLoad();
+        }
+
+        int TReactorPool::CurrentIndex() {
+            return CurrentIndex_;
+        }
+
+        void TReactorPool::Dispatch(TReactor& from, int fd) {
+            TReactor* target = &from;
+
+            if (Mode == ACCEPT_ROUND_ROBIN) {
+                target = RoundRobin.Next();
+
+            } else if (Mode == ACCEPT_LEAST_LOADED) {
+                for (auto& reactor : Reactors) {
+                    if (reactor->GetLoad() < target->GetLoad()) {
+                        target = reactor.get();
+                    }
+                }
+            }
+
+            // Counted right away so a burst of accepts spreads out
+            target->Reserve();
+
+            if (target == &from) {
+                target->Adopt(fd);
+                return;
+            }
+
+            target->Loop.Post(TAdoptTask<TReactor>(target, fd));
+        }
+    }
+}
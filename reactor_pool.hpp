@@ -0,0 +1,93 @@
+#pragma once
+
+#include "muhev.hpp"
+#include "round_robin_vector.hpp"
+#include <memory>
+#include <vector>
+#include <string>
+#include <functional>
+
+namespace NAC {
+    namespace NMuhEv {
+        class TReactor;
+
+        // N TLoops on their own threads, each pinned to a CPU, serving
+        // connections accepted from one address.
+        class TReactorPool {
+        public:
+            enum EAcceptMode {
+                // Every loop has its own SO_REUSEPORT listener
+                ACCEPT_REUSEPORT,
+                // The first loop accepts and hands connections out in turn
+                ACCEPT_ROUND_ROBIN,
+                // The first loop accepts and picks the loop with the fewest
+                // live connections
+                ACCEPT_LEAST_LOADED,
+            };
+
+            // Called on the loop that will serve the non-blocking connection
+            // fd. The returned node owns fd and is registered with the
+            // loop; nullptr rejects the connection and fd gets closed.
+            using TFactory = std::function<std::unique_ptr<TNode>(TLoop& loop, int fd)>;
+
+        public:
+            TReactorPool() = delete;
+            TReactorPool(const TReactorPool&) = delete;
+            TReactorPool(TReactorPool&&) = delete;
+
+            // threads = 0 means one per CPU the process may run on, thread i
+            // is pinned to the i-th of them
+            TReactorPool(TFactory&& factory, size_t threads = 0, EAcceptMode mode = ACCEPT_REUSEPORT, bool pin = true);
+
+            // Stops without draining and joins
+            ~TReactorPool();
+
+            // Must be called before Start(), port 0 picks a free one
+            bool Listen(const std::string& host, unsigned short port, int backlog = 1024);
+
+            unsigned short Port() const {
+                return Port_;
+            }
+
+            void Start();
+
+            // Thread-safe. Stops accepting and lets every loop run until its
+            // connections are gone; after drainTimeoutMs (0 = no limit)
+            // the remaining ones are dropped.
+            void Stop(uint64_t drainTimeoutMs = 0);
+
+            void Join();
+
+            size_t Size() const {
+                return Reactors.size();
+            }
+
+            TLoop& GetLoop(size_t index);
+
+            // Runs cb on loop index, from any thread
+            template<typename TCb>
+            void Post(size_t index, TCb&& cb) {
+                GetLoop(index).Post(std::forward<TCb>(cb));
+            }
+
+            size_t ConnectionCount(size_t index) const;
+
+            // Index of the loop running on the calling thread, -1 elsewhere
+            static int CurrentIndex();
+
+        private:
+            friend class TReactor;
+
+            void Dispatch(TReactor& from, int fd);
+
+        private:
+            TFactory Factory;
+            EAcceptMode Mode;
+            bool Pin;
+            bool Started = false;
+            unsigned short Port_ = 0;
+            std::vector<std::unique_ptr<TReactor>> Reactors;
+            NUtils::TRoundRobinVector<TReactor*> RoundRobin;
+        };
+    }
+}
@@ -0,0 +1,223 @@
+#include "record_log.hpp"
+#include "utils/crc32c.hpp"
+#include "utils/htonll.hpp"
+#include "utils/memmem.hpp"
+
+#include <string.h>
+
+namespace NAC {
+    namespace {
+        enum EFrameType : unsigned char {
+            FRAME_VARINT = 1,
+            FRAME_FIXED32 = 2,
+            FRAME_SYNC = 3,
+        };
+
+        static const size_t MAX_HEADER_SIZE = 1 + 10;
+        static const size_t CRC_SIZE = sizeof(uint32_t);
+        static const size_t SYNC_MAGIC_SIZE = 16;
+        static const char SYNC_MAGIC[SYNC_MAGIC_SIZE + 1] = "\xac\x52\x4c\x9e\x17\xd3\x5b\x02\xe6\x8f\x31\xc4\x7a\x0d\xb9\x64";
+        static const size_t SYNC_FRAME_SIZE = 1 + sizeof(uint32_t) + SYNC_MAGIC_SIZE + CRC_SIZE;
+
+        static inline size_t PutVarint(char* out, uint64_t value) {
+            size_t len(0);
+
+            while (value >= 0x80) {
+                out[len++] = (char)((value & 0x7f) | 0x80);
+                value >>= 7;
+            }
+
+            out[len++] = (char)value;
+
+            return len;
+        }
+
+        static inline bool GetVarint(const char* data, size_t size, uint64_t& value, size_t& len) {
+            value = 0;
+
+            for (len = 0; (len < size) && (len < 10); ++len) {
+                const unsigned char byte(data[len]);
+                value |= ((uint64_t)(byte & 0x7f) << (7 * len));
+
+                if (!(byte & 0x80)) {
+                    ++len;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        static inline void PutCrc(char* out, uint32_t crc) {
+            crc = hton(crc);
+            memcpy(out, &crc, sizeof(crc));
+        }
+
+        static inline uint32_t GetCrc(const char* data) {
+            uint32_t crc;
+            memcpy(&crc, data, sizeof(crc));
+
+            return ntoh(crc);
+        }
+
+        struct TSyncFrame {
+            char Data[SYNC_FRAME_SIZE];
+
+            TSyncFrame() {
+                Data[0] = FRAME_SYNC;
+
+                const uint32_t len(hton((uint32_t)SYNC_MAGIC_SIZE));
+                memcpy(Data + 1, &len, sizeof(len));
+                memcpy(Data + 1 + sizeof(len), SYNC_MAGIC, SYNC_MAGIC_SIZE);
+
+                PutCrc(Data + SYNC_FRAME_SIZE - CRC_SIZE, Crc32c(SYNC_FRAME_SIZE - CRC_SIZE, Data));
+            }
+        };
+
+        static const TSyncFrame& SyncFrame() {
+            static const TSyncFrame frame;
+
+            return frame;
+        }
+    }
+
+    TRecordLogWriter& TRecordLogWriter::Append(const size_t size, const char* data) {
+        if (!Started || (SinceSync >= SyncInterval)) {
+            Sync();
+        }
+
+        char header[MAX_HEADER_SIZE];
+        size_t headerSize(1);
+
+        if (Length == LENGTH_FIXED32) {
+            header[0] = FRAME_FIXED32;
+
+            const uint32_t len(hton((uint32_t)size));
+            memcpy(header + 1, &len, sizeof(len));
+            headerSize += sizeof(len);
+
+        } else {
+            header[0] = FRAME_VARINT;
+            headerSize += PutVarint(header + 1, size);
+        }
+
+        char crc[CRC_SIZE];
+        PutCrc(crc, Crc32c(size, data, Crc32c(headerSize, header)));
+
+        Buf.Shrink(0);
+        Buf.Append(headerSize, header);
+        Buf.Append(size, data);
+        Buf.Append(CRC_SIZE, crc);
+
+        File.Append(Buf.Size(), Buf.Data());
+        SinceSync += Buf.Size();
+
+        return *this;
+    }
+
+    void TRecordLogWriter::Sync() {
+        File.Append(SYNC_FRAME_SIZE, SyncFrame().Data);
+
+        Started = true;
+        SinceSync = 0;
+    }
+
+    TRecordLogReader::TRecordLogReader(
+        const size_t size,
+        const char* data,
+        size_t begin,
+        size_t end
+    )
+        : Data(data)
+        , Size(data ? size : 0)
+        , End(end)
+        , Pos(Size)
+    {
+        if (begin == 0) {
+            Pos = 0;
+
+        } else if (begin < End) {
+            Pos = begin;
+            SkipToSync(begin);
+            Skipped_ = 0;
+        }
+
+        if (Pos >= End) {
+            Pos = Size;
+        }
+    }
+
+    bool TRecordLogReader::SkipToSync(size_t from) {
+        const auto& frame = SyncFrame();
+        const char* found((from < Size)
+            ? MemMem(Size - from, Data + from, SYNC_FRAME_SIZE, frame.Data)
+            : nullptr
+        );
+
+        const size_t next(found ? (found - Data) : Size);
+
+        Skipped_ += next - Pos;
+        Pos = next;
+
+        return (bool)found;
+    }
+
+    TBlob TRecordLogReader::Next() {
+        const auto& sync = SyncFrame();
+
+        while (Pos < Size) {
+            const char* frame(Data + Pos);
+            const size_t left(Size - Pos);
+            const unsigned char type(frame[0]);
+
+            if ((type == FRAME_SYNC) && (left >= SYNC_FRAME_SIZE) && (memcmp(frame, sync.Data, SYNC_FRAME_SIZE) == 0)) {
+                if (Pos >= End) {
+                    Pos = Size;
+                    break;
+                }
+
+                Pos += SYNC_FRAME_SIZE;
+                continue;
+            }
+
+            uint64_t len(0);
+            size_t headerSize(1);
+            bool ok(false);
+
+            if (type == FRAME_VARINT) {
+                size_t varintSize;
+                ok = GetVarint(frame + 1, left - 1, len, varintSize);
+                headerSize += varintSize;
+
+            } else if ((type == FRAME_FIXED32) && (left >= (1 + sizeof(uint32_t)))) {
+                uint32_t len32;
+                memcpy(&len32, frame + 1, sizeof(len32));
+                len = ntoh(len32);
+                headerSize += sizeof(len32);
+                ok = true;
+            }
+
+            ok = (ok && (len <= (left - headerSize)) && (CRC_SIZE <= (left - headerSize - len)));
+
+            if (ok) {
+                const uint32_t crc(Crc32c(headerSize + len, frame));
+                ok = (crc == GetCrc(frame + headerSize + len));
+            }
+
+            if (!ok) {
+                // Torn tail or garbage: resync at the next marker
+                if (!SkipToSync(Pos + 1)) {
+                    break;
+                }
+
+                continue;
+            }
+
+            Pos += headerSize + len + CRC_SIZE;
+
+            return TBlob(len, frame + headerSize);
+        }
+
+        return TBlob();
+    }
+}
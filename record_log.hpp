@@ -0,0 +1,112 @@
+#pragma once
+
+#include "file.hpp"
+#include "str.hpp"
+#include <string>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace NAC {
+    // Frame: [type:1][length][payload][crc32c(type, length, payload):4]
+    // Length is either a varint or a big-endian uint32, depending on type.
+    // Sync frames carry a fixed 16-byte magic and are emitted every
+    // syncInterval bytes, so a reader can start from any of them.
+    class TRecordLogWriter {
+    public:
+        enum ELength {
+            LENGTH_VARINT,
+            LENGTH_FIXED32,
+        };
+
+    public:
+        TRecordLogWriter() = delete;
+        TRecordLogWriter(const TRecordLogWriter&) = delete;
+        TRecordLogWriter(TRecordLogWriter&&) = default;
+
+        TRecordLogWriter(
+            TFile& file,
+            ELength length = LENGTH_VARINT,
+            size_t syncInterval = 64 * 1024
+        )
+            : File(file)
+            , Length(length)
+            , SyncInterval(syncInterval)
+        {
+        }
+
+        TRecordLogWriter& Append(const size_t size, const char* data);
+
+        TRecordLogWriter& Append(const TBlob& src) {
+            return Append(src.Size(), src.Data());
+        }
+
+        TRecordLogWriter& Append(const std::string& src) {
+            return Append(src.size(), src.data());
+        }
+
+        template<typename... TArgs>
+        TRecordLogWriter& operator<<(TArgs&&... args) {
+            return Append(std::forward<TArgs&&>(args)...);
+        }
+
+        void Sync();
+
+        explicit operator bool() const {
+            return (bool)File;
+        }
+
+    private:
+        TFile& File;
+        ELength Length;
+        size_t SyncInterval;
+        size_t SinceSync = 0;
+        bool Started = false;
+        TBlob Buf;
+    };
+
+    class TRecordLogReader {
+    public:
+        // Reads records governed by sync frames located in [begin, end):
+        // starts from the first sync frame at or after begin (unless
+        // begin == 0) and stops at the first one at or after end, so
+        // adjacent ranges can be read in parallel without overlap.
+        TRecordLogReader(
+            const size_t size,
+            const char* data,
+            size_t begin = 0,
+            size_t end = -1
+        );
+
+        TRecordLogReader(const TFile& file, size_t begin = 0, size_t end = -1)
+            : TRecordLogReader(file.Size(), file.Data(), begin, end)
+        {
+        }
+
+        // Returns a view into the underlying memory, falsy at the end.
+        // Empty records are returned as non-null TBlobs of size 0.
+        TBlob Next();
+
+        size_t Offset() const {
+            return Pos;
+        }
+
+        // Bytes skipped because of torn or corrupted frames
+        size_t Skipped() const {
+            return Skipped_;
+        }
+
+        explicit operator bool() const {
+            return (Pos < Size);
+        }
+
+    private:
+        bool SkipToSync(size_t from);
+
+    private:
+        const char* Data;
+        size_t Size;
+        size_t End;
+        size_t Pos = 0;
+        size_t Skipped_ = 0;
+    };
+}
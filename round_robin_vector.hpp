@@ -40,5 +40,10 @@ namespace NAC {
 
             inline Value Next();
         };
+
+        template<typename Value>
+        inline Value TRoundRobinVector<Value>::Next() {
+            return NextImpl();
+        }
     }
 }
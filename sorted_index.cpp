@@ -0,0 +1,369 @@
+#include "sorted_index.hpp"
+#include "utils/htonll.hpp"
+
+#include <string.h>
+#include <stdexcept>
+#include <functional>
+#include <algorithm>
+
+namespace NAC {
+    namespace {
+        static const char MAGIC[9] = "ACSIDX01";
+        static const size_t FOOTER_SIZE = 64;
+        static const size_t BLOCK_REF_SIZE = 24;
+        static const size_t EYTZINGER_ITEM_SIZE = 16;
+        static const size_t ALIGNMENT = 64;
+
+        static inline size_t PutVarint(char* out, uint64_t value) {
+            size_t len(0);
+
+            while (value >= 0x80) {
+                out[len++] = (char)((value & 0x7f) | 0x80);
+                value >>= 7;
+            }
+
+            out[len++] = (char)value;
+
+            return len;
+        }
+
+        static inline bool GetVarint(const char* data, uint64_t size, uint64_t& value, uint64_t& pos) {
+            value = 0;
+
+            for (size_t shift = 0; (pos < size) && (shift < 64); shift += 7) {
+                const unsigned char byte(data[pos++]);
+                value |= ((uint64_t)(byte & 0x7f) << shift);
+
+                if (!(byte & 0x80)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        template<typename T>
+        static inline void Put(char* out, T value) {
+            value = hton(value);
+            memcpy(out, &value, sizeof(value));
+        }
+
+        template<typename T>
+        static inline T Get(const char* data) {
+            T value;
+            memcpy(&value, data, sizeof(value));
+
+            return ntoh(value);
+        }
+
+        // First 8 bytes, big-endian and zero-padded: comparing prefixes as
+        // integers agrees with TBlob::Cmp whenever they differ
+        static inline uint64_t KeyPrefix(const size_t size, const char* data) {
+            char buf[sizeof(uint64_t)] = { 0 };
+
+            if (size > 0) {
+                memcpy(buf, data, std::min(size, sizeof(buf)));
+            }
+
+            return Get<uint64_t>(buf);
+        }
+    }
+
+    void TSortedIndexBuilder::Add(const size_t keySize, const char* key, const size_t valueSize, const char* value) {
+        if (HasLastKey && (LastKey.Cmp(keySize, key) >= 0)) {
+            throw std::logic_error("Keys must be added in strictly ascending order");
+        }
+
+        LastKey.Shrink(0);
+        LastKey.Append(keySize, key);
+        HasLastKey = true;
+
+        char header[20];
+        size_t headerSize(PutVarint(header, keySize));
+        headerSize += PutVarint(header + headerSize, valueSize);
+
+        if (Block.Size() == 0) {
+            Blocks.emplace_back(TBlockRef{
+                Offset,
+                0,
+                (uint32_t)keySize,
+                Offset + headerSize,
+                KeyPrefix(keySize, key)
+            });
+        }
+
+        Block.Append(headerSize, header);
+        Block.Append(keySize, key);
+        Block.Append(valueSize, value);
+        ++Count;
+
+        if (Block.Size() >= BlockSize) {
+            FlushBlock();
+        }
+    }
+
+    void TSortedIndexBuilder::FlushBlock() {
+        if (Block.Size() == 0) {
+            return;
+        }
+
+        Blocks.back().Size = Block.Size();
+
+        File.Append(Block.Size(), Block.Data());
+        Offset += Block.Size();
+        Block.Shrink(0);
+    }
+
+    bool TSortedIndexBuilder::Finish() {
+        FlushBlock();
+
+        const uint64_t indexOffset(Offset);
+        TBlob buf;
+        buf.Reserve(Blocks.size() * BLOCK_REF_SIZE + ALIGNMENT);
+
+        for (const auto& block : Blocks) {
+            char item[BLOCK_REF_SIZE];
+
+            Put<uint64_t>(item, block.Offset);
+            Put<uint32_t>(item + 8, block.Size);
+            Put<uint32_t>(item + 12, block.KeySize);
+            Put<uint64_t>(item + 16, block.KeyOffset);
+
+            buf.Append(BLOCK_REF_SIZE, item);
+        }
+
+        const char zeros[ALIGNMENT] = { 0 };
+        const size_t padding((ALIGNMENT - ((indexOffset + buf.Size()) % ALIGNMENT)) % ALIGNMENT);
+        buf.Append(padding, zeros);
+
+        File.Append(buf.Size(), buf.Data());
+        Offset += buf.Size();
+
+        // Eytzinger (BFS) order, 1-based, so children of k are 2k and 2k + 1
+        const uint64_t eytzingerOffset(Offset);
+        const size_t n(Blocks.size());
+        std::vector<char> eytzinger((n + 1) * EYTZINGER_ITEM_SIZE, 0);
+        size_t i(0);
+
+        std::function<void(size_t)> fill = [&](size_t k) {
+            if (k > n) {
+                return;
+            }
+
+            fill(2 * k);
+
+            Put<uint64_t>(&eytzinger[k * EYTZINGER_ITEM_SIZE], Blocks[i].Prefix);
+            Put<uint64_t>(&eytzinger[k * EYTZINGER_ITEM_SIZE + 8], i);
+            ++i;
+
+            fill(2 * k + 1);
+        };
+
+        fill(1);
+
+        File.Append(eytzinger.size(), eytzinger.data());
+        Offset += eytzinger.size();
+
+        char footer[FOOTER_SIZE] = { 0 };
+        memcpy(footer, MAGIC, 8);
+        Put<uint64_t>(footer + 8, Count);
+        Put<uint64_t>(footer + 16, n);
+        Put<uint64_t>(footer + 24, indexOffset);
+        Put<uint64_t>(footer + 32, eytzingerOffset);
+
+        File.Append(FOOTER_SIZE, footer);
+        Offset += FOOTER_SIZE;
+
+        return (bool)File;
+    }
+
+    TSortedIndex::TSortedIndex(const size_t size, const char* data)
+        : Data(data)
+    {
+        if (!data || (size < FOOTER_SIZE)) {
+            return;
+        }
+
+        const char* footer(data + size - FOOTER_SIZE);
+
+        if (memcmp(footer, MAGIC, 8) != 0) {
+            return;
+        }
+
+        Count = Get<uint64_t>(footer + 8);
+        BlockCount = Get<uint64_t>(footer + 16);
+
+        const uint64_t indexOffset(Get<uint64_t>(footer + 24));
+        const uint64_t eytzingerOffset(Get<uint64_t>(footer + 32));
+
+        if (
+            (indexOffset + BlockCount * BLOCK_REF_SIZE > eytzingerOffset)
+            || (eytzingerOffset + (BlockCount + 1) * EYTZINGER_ITEM_SIZE > (size - FOOTER_SIZE))
+        ) {
+            return;
+        }
+
+        BlockIndex = data + indexOffset;
+        Eytzinger = data + eytzingerOffset;
+        Ok = true;
+    }
+
+    uint64_t TSortedIndex::BlockOffset(uint64_t block) const {
+        return Get<uint64_t>(BlockIndex + block * BLOCK_REF_SIZE);
+    }
+
+    uint64_t TSortedIndex::BlockEnd(uint64_t block) const {
+        const char* ref(BlockIndex + block * BLOCK_REF_SIZE);
+
+        return Get<uint64_t>(ref) + Get<uint32_t>(ref + 8);
+    }
+
+    TBlob TSortedIndex::BlockKey(uint64_t block) const {
+        const char* ref(BlockIndex + block * BLOCK_REF_SIZE);
+
+        return TBlob(Get<uint32_t>(ref + 12), Data + Get<uint64_t>(ref + 16));
+    }
+
+    int64_t TSortedIndex::FindBlock(const size_t keySize, const char* key) const {
+        // Last block whose first key is <= key, -1 if there is none
+        const uint64_t prefix(KeyPrefix(keySize, key));
+        uint64_t k(1);
+
+        while (k <= BlockCount) {
+            __builtin_prefetch(Eytzinger + k * 4 * EYTZINGER_ITEM_SIZE);
+
+            const char* item(Eytzinger + k * EYTZINGER_ITEM_SIZE);
+            const uint64_t itemPrefix(Get<uint64_t>(item));
+            bool lessOrEqual;
+
+            if (itemPrefix != prefix) {
+                lessOrEqual = (itemPrefix < prefix);
+
+            } else {
+                lessOrEqual = (BlockKey(Get<uint64_t>(item + 8)).Cmp(keySize, key) <= 0);
+            }
+
+            k = 2 * k + (lessOrEqual ? 1 : 0);
+        }
+
+        // Strip the trailing "went right" steps to get the first item > key
+        k >>= __builtin_ffsll(~k);
+
+        if (k == 0) {
+            return BlockCount - 1;
+        }
+
+        return (int64_t)Get<uint64_t>(Eytzinger + k * EYTZINGER_ITEM_SIZE + 8) - 1;
+    }
+
+    bool TSortedIndex::ReadEntry(uint64_t& pos, uint64_t end, TBlob& key, TBlob& value) const {
+        uint64_t keySize;
+        uint64_t valueSize;
+
+        if (!GetVarint(Data, end, keySize, pos) || !GetVarint(Data, end, valueSize, pos)) {
+            return false;
+        }
+
+        if ((pos + keySize + valueSize) > end) {
+            return false;
+        }
+
+        key.Wrap(keySize, Data + pos);
+        value.Wrap(valueSize, Data + pos + keySize);
+        pos += keySize + valueSize;
+
+        return true;
+    }
+
+    bool TSortedIndex::Find(const size_t keySize, const char* key, TBlob& value) const {
+        if (!Ok || (BlockCount == 0)) {
+            return false;
+        }
+
+        const int64_t block(FindBlock(keySize, key));
+
+        if (block < 0) {
+            return false;
+        }
+
+        uint64_t pos(BlockOffset(block));
+        const uint64_t end(BlockEnd(block));
+        TBlob entryKey;
+        TBlob entryValue;
+
+        while ((pos < end) && ReadEntry(pos, end, entryKey, entryValue)) {
+            const int rv(entryKey.Cmp(keySize, key));
+
+            if (rv == 0) {
+                value.Wrap(entryValue.Size(), entryValue.Data());
+                return true;
+            }
+
+            if (rv > 0) {
+                break;
+            }
+        }
+
+        return false;
+    }
+
+    TSortedIndex::TIterator TSortedIndex::LowerBound(const TBlob& key) const {
+        if (!Ok || (BlockCount == 0)) {
+            return TIterator(this, BlockCount, 0, TBlob());
+        }
+
+        const int64_t found(FindBlock(key.Size(), key.Data()));
+        const uint64_t block((found < 0) ? 0 : found);
+        uint64_t pos(BlockOffset(block));
+        const uint64_t end(BlockEnd(block));
+        TBlob entryKey;
+        TBlob entryValue;
+
+        while (pos < end) {
+            uint64_t next(pos);
+
+            if (!ReadEntry(next, end, entryKey, entryValue) || (entryKey.Cmp(key) >= 0)) {
+                break;
+            }
+
+            pos = next;
+        }
+
+        return TIterator(this, block, pos, TBlob());
+    }
+
+    TSortedIndex::TIterator TSortedIndex::Prefix(const TBlob& prefix) const {
+        auto it = LowerBound(prefix);
+        it.Prefix.Append(prefix.Size(), prefix.Data());
+
+        return it;
+    }
+
+    bool TSortedIndex::TIterator::Next(TBlob& key, TBlob& value) {
+        while (Block < Index->BlockCount) {
+            const uint64_t end(Index->BlockEnd(Block));
+
+            if (Pos >= end) {
+                if (++Block < Index->BlockCount) {
+                    Pos = Index->BlockOffset(Block);
+                }
+
+                continue;
+            }
+
+            if (!Index->ReadEntry(Pos, end, key, value)) {
+                Block = Index->BlockCount;
+                break;
+            }
+
+            if ((Prefix.Size() > 0) && !key.StartsWith(Prefix)) {
+                Block = Index->BlockCount;
+                break;
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "file.hpp"
+#include "str.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace NAC {
+    // Immutable sorted key/value file:
+    //   [data blocks][block index][eytzinger top level][footer]
+    // Keys are ordered by TBlob::Cmp and must be unique.
+    class TSortedIndexBuilder {
+    public:
+        TSortedIndexBuilder() = delete;
+        TSortedIndexBuilder(const TSortedIndexBuilder&) = delete;
+        TSortedIndexBuilder(TSortedIndexBuilder&&) = default;
+
+        TSortedIndexBuilder(TFile& file, size_t blockSize = 4096)
+            : File(file)
+            , BlockSize(blockSize)
+        {
+        }
+
+        // Throws std::logic_error if key is not greater than the previous one
+        void Add(const size_t keySize, const char* key, const size_t valueSize, const char* value);
+
+        void Add(const TBlob& key, const TBlob& value) {
+            Add(key.Size(), key.Data(), value.Size(), value.Data());
+        }
+
+        void Add(const std::string& key, const std::string& value) {
+            Add(key.size(), key.data(), value.size(), value.data());
+        }
+
+        bool Finish();
+
+    private:
+        void FlushBlock();
+
+    private:
+        struct TBlockRef {
+            uint64_t Offset;
+            uint32_t Size;
+            uint32_t KeySize;
+            uint64_t KeyOffset;
+            uint64_t Prefix;
+        };
+
+    private:
+        TFile& File;
+        size_t BlockSize;
+        TBlob Block;
+        TBlob LastKey;
+        bool HasLastKey = false;
+        uint64_t Offset = 0;
+        uint64_t Count = 0;
+        std::vector<TBlockRef> Blocks;
+    };
+
+    class TSortedIndex {
+    public:
+        class TIterator {
+        public:
+            // key and value point into the mapping
+            bool Next(TBlob& key, TBlob& value);
+
+        private:
+            friend class TSortedIndex;
+
+            TIterator(const TSortedIndex* index, uint64_t block, uint64_t pos, const TBlob& prefix)
+                : Index(index)
+                , Block(block)
+                , Pos(pos)
+            {
+                Prefix.Append(prefix.Size(), prefix.Data());
+            }
+
+        private:
+            const TSortedIndex* Index;
+            uint64_t Block;
+            uint64_t Pos;
+            TBlob Prefix;
+        };
+
+    public:
+        TSortedIndex(const size_t size, const char* data);
+
+        TSortedIndex(const TFile& file)
+            : TSortedIndex(file.Size(), file.Data())
+        {
+        }
+
+        explicit operator bool() const {
+            return Ok;
+        }
+
+        uint64_t Size() const {
+            return Count;
+        }
+
+        // Doesn't allocate, value points into the mapping
+        bool Find(const size_t keySize, const char* key, TBlob& value) const;
+
+        bool Find(const TBlob& key, TBlob& value) const {
+            return Find(key.Size(), key.Data(), value);
+        }
+
+        bool Find(const std::string& key, TBlob& value) const {
+            return Find(key.size(), key.data(), value);
+        }
+
+        // All keys >= key, in order
+        TIterator LowerBound(const TBlob& key) const;
+
+        // All keys starting with prefix, in order
+        TIterator Prefix(const TBlob& prefix) const;
+
+        TIterator Prefix(const std::string& prefix) const {
+            return Prefix(TBlob(prefix.size(), prefix.data()));
+        }
+
+        TIterator begin() const {
+            return LowerBound(TBlob());
+        }
+
+    private:
+        int64_t FindBlock(const size_t keySize, const char* key) const;
+        TBlob BlockKey(uint64_t block) const;
+        uint64_t BlockOffset(uint64_t block) const;
+        uint64_t BlockEnd(uint64_t block) const;
+        bool ReadEntry(uint64_t& pos, uint64_t end, TBlob& key, TBlob& value) const;
+
+    private:
+        const char* Data = nullptr;
+        uint64_t Count = 0;
+        uint64_t BlockCount = 0;
+        const char* BlockIndex = nullptr;
+        const char* Eytzinger = nullptr;
+        bool Ok = false;
+    };
+}
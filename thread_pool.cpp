@@ -0,0 +1,255 @@
+#include "thread_pool.hpp"
+#include "worker_lite.hpp"
+
+#include <unistd.h>
+
+namespace NAC {
+    namespace NBase {
+        namespace {
+            static thread_local TPoolWorker* CurrentWorker = nullptr;
+            static thread_local uint64_t StealSeed = 0;
+
+            // xorshift64, seeded per thread
+            static inline uint64_t NextRandom() {
+                if (StealSeed == 0) {
+                    StealSeed = ((uint64_t)(uintptr_t)&StealSeed | 1);
+                }
+
+                StealSeed ^= (StealSeed << 13);
+                StealSeed ^= (StealSeed >> 7);
+                StealSeed ^= (StealSeed << 17);
+
+                return StealSeed;
+            }
+        }
+
+        class TPoolWorker : public TWorkerLite {
+        public:
+            TPoolWorker(TThreadPool& pool, int index)
+                : Pool(pool)
+                , Index(index)
+            {
+            }
+
+            ~TPoolWorker() {
+                Join();
+            }
+
+            void Run() override {
+                CurrentWorker = this;
+
+                while (true) {
+                    if (TPoolTask* task = Pool.Find(this)) {
+                        TThreadPool::RunTask(task);
+                        continue;
+                    }
+
+                    const uint32_t key = Pool.Lot.Prepare();
+
+                    if (Pool.HasWork()) {
+                        Pool.Lot.Cancel();
+                        continue;
+                    }
+
+                    // Only once everything queued has run
+                    if (Pool.Stopping.load()) {
+                        Pool.Lot.Cancel();
+                        break;
+                    }
+
+                    Pool.Lot.Park(key);
+                }
+
+                CurrentWorker = nullptr;
+            }
+
+        public:
+            TThreadPool& Pool;
+            const int Index;
+            NUtils::TWorkStealingDeque<TPoolTask*> Deque;
+        };
+
+        TThreadPool::TThreadPool(size_t threads) {
+            if (threads == 0) {
+                const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                threads = ((cpus > 0) ? cpus : 1);
+            }
+
+            for (size_t i = 0; i < threads; ++i) {
+                Workers.emplace_back(new TPoolWorker(*this, i));
+            }
+
+            // Started once all of them exist, they steal from each other
+            for (auto& worker : Workers) {
+                worker->Start();
+            }
+        }
+
+        TThreadPool::~TThreadPool() {
+            Stopping.store(true);
+            Lot.UnparkAll();
+
+            for (auto& worker : Workers) {
+                worker->Join();
+            }
+        }
+
+        int TThreadPool::CurrentIndex() const {
+            if (CurrentWorker && (&CurrentWorker->Pool == this)) {
+                return CurrentWorker->Index;
+            }
+
+            return -1;
+        }
+
+        void TThreadPool::SpawnImpl(TPoolTask* task) {
+            if (CurrentWorker && (&CurrentWorker->Pool == this)) {
+                CurrentWorker->Deque.Push(task);
+
+            } else {
+                std::lock_guard<std::mutex> guard(InjectedLock);
+                Injected.push_back(task);
+                InjectedCount.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            Lot.UnparkOne();
+        }
+
+        TPoolTask* TThreadPool::Find(TPoolWorker* worker) {
+            TPoolTask* task = nullptr;
+
+            if (worker && worker->Deque.Pop(task)) {
+                return task;
+            }
+
+            task = Take(worker);
+
+            // Spawning wakes one thread at a time, the ones finding work
+            // elsewhere wake the next while there is more
+            if (task && HasWork()) {
+                Lot.UnparkOne();
+            }
+
+            return task;
+        }
+
+        TPoolTask* TThreadPool::Take(TPoolWorker* worker) {
+            TPoolTask* task = nullptr;
+
+            if (InjectedCount.load(std::memory_order_relaxed) > 0) {
+                std::lock_guard<std::mutex> guard(InjectedLock);
+
+                if (!Injected.empty()) {
+                    task = Injected.front();
+                    Injected.pop_front();
+                    InjectedCount.fetch_sub(1, std::memory_order_relaxed);
+
+                    return task;
+                }
+            }
+
+            const size_t count = Workers.size();
+            const size_t start = (NextRandom() % count);
+
+            for (size_t i = 0; i < count; ++i) {
+                TPoolWorker* victim = Workers[(start + i) % count].get();
+
+                if ((victim != worker) && victim->Deque.Steal(task)) {
+                    return task;
+                }
+            }
+
+            return nullptr;
+        }
+
+        bool TThreadPool::RunOne() {
+            TPoolTask* task = Find((CurrentWorker && (&CurrentWorker->Pool == this)) ? CurrentWorker : nullptr);
+
+            if (!task) {
+                return false;
+            }
+
+            RunTask(task);
+
+            return true;
+        }
+
+        bool TThreadPool::HasWork() const {
+            if (InjectedCount.load() > 0) {
+                return true;
+            }
+
+            for (const auto& worker : Workers) {
+                if (!worker->Deque.Empty()) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void TThreadPool::RunTask(TPoolTask* task) {
+            try {
+                task->Run();
+
+            } catch (...) {
+            }
+
+            delete task;
+        }
+
+        TTaskGroup::~TTaskGroup() {
+            WaitImpl();
+        }
+
+        void TTaskGroup::Wait() {
+            WaitImpl();
+
+            if (Failed.load()) {
+                std::exception_ptr error;
+                std::swap(error, Error);
+                Failed.store(false);
+
+                std::rethrow_exception(error);
+            }
+        }
+
+        void TTaskGroup::Fail(std::exception_ptr error) {
+            if (!Failed.exchange(true)) {
+                Error = error;
+            }
+        }
+
+        void TTaskGroup::Done() {
+            // The group may be gone as soon as Pending drops to zero
+            TThreadPool& pool = Pool;
+
+            if (Pending.fetch_sub(1) == (WAITING | 1)) {
+                pool.Lot.UnparkAll();
+            }
+        }
+
+        void TTaskGroup::WaitImpl() {
+            while ((Pending.load() & ~WAITING) > 0) {
+                if (Pool.RunOne()) {
+                    continue;
+                }
+
+                // Parks with the pool's idle workers: new tasks wake it to
+                // help, the last task of the group wakes everyone
+                Pending.fetch_or(WAITING);
+
+                const uint32_t key = Pool.Lot.Prepare();
+
+                if (((Pending.load() & ~WAITING) == 0) || Pool.HasWork()) {
+                    Pool.Lot.Cancel();
+                    continue;
+                }
+
+                Pool.Lot.Park(key);
+            }
+
+            Pending.fetch_and(~WAITING);
+        }
+    }
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include "work_stealing_deque.hpp"
+#include "parking_lot.hpp"
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <future>
+#include <utility>
+#include <exception>
+#include <type_traits>
+#include <algorithm>
+#include <stddef.h>
+
+namespace NAC {
+    namespace NBase {
+        class TPoolWorker;
+        class TTaskGroup;
+
+        class TPoolTask {
+        public:
+            virtual ~TPoolTask() {
+            }
+
+            virtual void Run() = 0;
+        };
+
+        template<typename TCb>
+        class TPoolTaskImpl : public TPoolTask {
+        public:
+            TPoolTaskImpl(TCb&& cb)
+                : Cb_(std::move(cb))
+            {
+            }
+
+            TPoolTaskImpl(const TCb& cb)
+                : Cb_(cb)
+            {
+            }
+
+            void Run() override {
+                Cb_();
+            }
+
+        private:
+            TCb Cb_;
+        };
+
+        // N TWorkerLite threads, each with its own Chase-Lev deque. Tasks
+        // spawned by a worker go to its deque and run newest first, idle
+        // workers steal the oldest ones from the others; tasks from other
+        // threads go through a shared queue. Idle workers sleep on a futex.
+        //
+        // Blocking on a future from inside a task may deadlock the pool,
+        // tasks wait for each other with a TTaskGroup, which runs pending
+        // tasks meanwhile.
+        class TThreadPool {
+        public:
+            TThreadPool(const TThreadPool&) = delete;
+            TThreadPool(TThreadPool&&) = delete;
+
+            // threads = 0 means one per online CPU
+            TThreadPool(size_t threads = 0);
+
+            // Runs what is already queued and joins
+            ~TThreadPool();
+
+            size_t Size() const {
+                return Workers.size();
+            }
+
+            // Thread-safe. Exceptions thrown by cb are dropped.
+            template<typename TCb>
+            void Spawn(TCb&& cb) {
+                SpawnImpl(new TPoolTaskImpl<typename std::decay<TCb>::type>(std::forward<TCb>(cb)));
+            }
+
+            // Thread-safe
+            template<typename TCb>
+            auto Submit(TCb&& cb) -> std::future<decltype(cb())> {
+                std::packaged_task<decltype(cb())()> task(std::forward<TCb>(cb));
+                auto out = task.get_future();
+
+                Spawn(std::move(task));
+
+                return out;
+            }
+
+            // Calls cb(i) for every i in [begin, end) and returns once all
+            // of them have. The range is split in halves down to grain
+            // indices (0 picks one for about 8 pieces per worker), the
+            // calling thread takes part. The first exception thrown by cb
+            // is rethrown.
+            template<typename TCb>
+            void ParallelFor(size_t begin, size_t end, TCb&& cb, size_t grain = 0);
+
+            // Index of the pool worker running on the calling thread, -1
+            // elsewhere
+            int CurrentIndex() const;
+
+        private:
+            friend class TPoolWorker;
+            friend class TTaskGroup;
+
+            void SpawnImpl(TPoolTask* task);
+            TPoolTask* Find(TPoolWorker* worker);
+            // From the shared queue or another worker
+            TPoolTask* Take(TPoolWorker* worker);
+            // Runs one pending task on the calling thread, false if there
+            // was none
+            bool RunOne();
+            bool HasWork() const;
+            static void RunTask(TPoolTask* task);
+
+        private:
+            std::vector<std::unique_ptr<TPoolWorker>> Workers;
+            // Not a TSpinLock: a submitter preempted while holding it would
+            // keep the workers spinning once threads outnumber CPUs
+            std::mutex InjectedLock;
+            std::deque<TPoolTask*> Injected;
+            std::atomic<size_t> InjectedCount{0};
+            NUtils::TParkingLot Lot;
+            std::atomic<bool> Stopping{false};
+        };
+
+        // Join counter for a batch of pool tasks. Run() may be called from
+        // any thread (including the group's own tasks) until Wait()
+        // returns; Wait() runs pending tasks of the pool while the group's
+        // aren't done and rethrows the first exception one of them threw.
+        // The destructor waits too.
+        class TTaskGroup {
+        public:
+            TTaskGroup() = delete;
+            TTaskGroup(const TTaskGroup&) = delete;
+            TTaskGroup(TTaskGroup&&) = delete;
+
+            TTaskGroup(TThreadPool& pool)
+                : Pool(pool)
+            {
+            }
+
+            ~TTaskGroup();
+
+            template<typename TCb>
+            void Run(TCb&& cb) {
+                Pending.fetch_add(1, std::memory_order_relaxed);
+
+                Pool.Spawn([this, cb = typename std::decay<TCb>::type(std::forward<TCb>(cb))]() mutable {
+                    try {
+                        cb();
+
+                    } catch (...) {
+                        Fail(std::current_exception());
+                    }
+
+                    Done();
+                });
+            }
+
+            void Wait();
+
+        private:
+            friend class TThreadPool;
+
+            static const uint64_t WAITING = (1ULL << 63);
+
+            void Fail(std::exception_ptr error);
+            void Done();
+            void WaitImpl();
+
+        private:
+            TThreadPool& Pool;
+            // Task count, with WAITING set while Wait() may sleep
+            std::atomic<uint64_t> Pending{0};
+            std::atomic<bool> Failed{false};
+            std::exception_ptr Error;
+        };
+
+        template<typename TCb>
+        void TThreadPool::ParallelFor(size_t begin, size_t end, TCb&& cb, size_t grain) {
+            if (begin >= end) {
+                return;
+            }
+
+            if (grain == 0) {
+                grain = std::max<size_t>((end - begin) / (Size() * 8), 1);
+            }
+
+            TTaskGroup group(*this);
+
+            struct TSplit {
+                TTaskGroup& Group;
+                TCb& Cb;
+                size_t Grain;
+
+                void operator()(size_t begin, size_t end) {
+                    // Halves are handed out for stealing, the rest runs here
+                    while ((end - begin) > Grain) {
+                        const size_t middle = begin + (end - begin) / 2;
+                        TSplit* self = this;
+
+                        Group.Run([self, middle, end]() {
+                            (*self)(middle, end);
+                        });
+
+                        end = middle;
+                    }
+
+                    for (size_t i = begin; i < end; ++i) {
+                        Cb(i);
+                    }
+                }
+            };
+
+            TSplit split{group, cb, grain};
+
+            try {
+                split(begin, end);
+
+            } catch (...) {
+                group.Fail(std::current_exception());
+            }
+
+            group.Wait();
+        }
+    }
+}
@@ -0,0 +1,432 @@
+#include "transfer.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#ifdef __linux__
+    #include <sys/sendfile.h>
+#endif
+
+namespace NAC {
+    namespace {
+        static const size_t TRANSFER_CHUNK_MAX = 0x7ffff000;
+        static const size_t RW_BUF_SIZE = 64 * 1024;
+        static const size_t PIPE_CHUNK_SIZE = 64 * 1024;
+
+        static inline bool IsAgain() {
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+        }
+
+#ifdef __linux__
+        static inline bool IsUnsupported() {
+            return (
+                (errno == EINVAL)
+                || (errno == ENOSYS)
+                || (errno == EXDEV)
+                || (errno == EOPNOTSUPP)
+                || (errno == EOVERFLOW)
+            );
+        }
+#endif
+    }
+
+    TFileTransfer::TFileTransfer(
+        int src,
+        int dst,
+        off_t offset,
+        size_t size,
+        EMode mode,
+        off_t dstOffset
+    )
+        : Src(src)
+        , Dst(dst)
+        , Offset_(offset)
+        , DstOffset(dstOffset)
+        , Left_(size)
+        , Mode_(mode)
+    {
+#ifdef __linux__
+        if (Mode_ == MODE_AUTO) {
+            struct stat buf;
+
+            if (fstat(Dst, &buf) == -1) {
+                perror("fstat");
+                Mode_ = MODE_RW;
+
+            } else if (S_ISSOCK(buf.st_mode)) {
+                Mode_ = MODE_SENDFILE;
+
+            } else if (S_ISREG(buf.st_mode)) {
+                Mode_ = MODE_COPY_FILE_RANGE;
+
+            } else if (S_ISFIFO(buf.st_mode)) {
+                Mode_ = MODE_SPLICE;
+
+            } else {
+                Mode_ = MODE_RW;
+            }
+        }
+
+        if ((Mode_ == MODE_SENDFILE) && (DstOffset != -1)) {
+            Mode_ = MODE_RW;
+        }
+#else
+        Mode_ = MODE_RW;
+#endif
+    }
+
+    TFileTransfer::TFileTransfer(TFileTransfer&& right)
+        : Src(right.Src)
+        , Dst(right.Dst)
+        , Offset_(right.Offset_)
+        , DstOffset(right.DstOffset)
+        , Left_(right.Left_)
+        , Mode_(right.Mode_)
+        , Pending(right.Pending)
+        , Buf(std::move(right.Buf))
+        , BufSize(right.BufSize)
+        , BufOffset(right.BufOffset)
+    {
+        Pipe[0] = right.Pipe[0];
+        Pipe[1] = right.Pipe[1];
+
+        right.Pipe[0] = right.Pipe[1] = -1;
+        right.Pending = 0;
+        right.Left_ = 0;
+    }
+
+    TFileTransfer::~TFileTransfer() {
+        for (int fd : Pipe) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+    }
+
+    TFileTransfer::EStatus TFileTransfer::Step() {
+        switch (Mode_) {
+            case MODE_SENDFILE:
+                return StepSendFile();
+
+            case MODE_COPY_FILE_RANGE:
+                return StepCopyFileRange();
+
+            case MODE_SPLICE:
+                return StepSplice();
+
+            default:
+                return StepRW();
+        }
+    }
+
+    TFileTransfer::EStatus TFileTransfer::Fallback() {
+        if (Pending > 0) {
+            // Some bytes are already stuck in the pipe, can't switch now
+            fprintf(stderr, "splice: unsupported with %zu bytes in the pipe\n", Pending);
+            return STATUS_ERROR;
+        }
+
+        Mode_ = MODE_RW;
+
+        return StepRW();
+    }
+
+    TFileTransfer::EStatus TFileTransfer::StepSendFile() {
+#ifdef __linux__
+        while (Left_ > 0) {
+            const ssize_t rv = sendfile(Dst, Src, &Offset_, std::min(Left_, TRANSFER_CHUNK_MAX));
+
+            if (rv < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                if (IsAgain()) {
+                    return STATUS_AGAIN;
+                }
+
+                if (IsUnsupported()) {
+                    return Fallback();
+                }
+
+                perror("sendfile");
+                return STATUS_ERROR;
+            }
+
+            if (rv == 0) {
+                // Source is shorter than requested
+                break;
+            }
+
+            Left_ -= rv;
+        }
+
+        return ((Left_ == 0) ? STATUS_DONE : STATUS_ERROR);
+#else
+        return StepRW();
+#endif
+    }
+
+    TFileTransfer::EStatus TFileTransfer::StepCopyFileRange() {
+#ifdef __linux__
+        while (Left_ > 0) {
+            const ssize_t rv = copy_file_range(
+                Src,
+                &Offset_,
+                Dst,
+                ((DstOffset == -1) ? nullptr : &DstOffset),
+                std::min(Left_, TRANSFER_CHUNK_MAX),
+                0
+            );
+
+            if (rv < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                if (IsAgain()) {
+                    return STATUS_AGAIN;
+                }
+
+                if (IsUnsupported() || (errno == EBADF)) {
+                    return Fallback();
+                }
+
+                perror("copy_file_range");
+                return STATUS_ERROR;
+            }
+
+            if (rv == 0) {
+                break;
+            }
+
+            Left_ -= rv;
+        }
+
+        return ((Left_ == 0) ? STATUS_DONE : STATUS_ERROR);
+#else
+        return StepRW();
+#endif
+    }
+
+    TFileTransfer::EStatus TFileTransfer::StepSplice() {
+#ifdef __linux__
+        struct stat buf;
+
+        if ((Pipe[0] == -1) && (fstat(Dst, &buf) == 0) && !S_ISFIFO(buf.st_mode)) {
+            if (pipe2(Pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+                perror("pipe2");
+                return Fallback();
+            }
+        }
+
+        const bool direct(Pipe[0] == -1);
+
+        while (Left_ > 0) {
+            if (!direct && (Pending > 0)) {
+                const ssize_t rv = splice(
+                    Pipe[0],
+                    nullptr,
+                    Dst,
+                    ((DstOffset == -1) ? nullptr : &DstOffset),
+                    Pending,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+                );
+
+                if (rv < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+
+                    if (IsAgain()) {
+                        return STATUS_AGAIN;
+                    }
+
+                    perror("splice");
+                    return STATUS_ERROR;
+                }
+
+                if (rv == 0) {
+                    // Nothing taken from a non-empty pipe: would spin
+                    fprintf(stderr, "splice: destination accepts no more data\n");
+                    return STATUS_ERROR;
+                }
+
+                Pending -= rv;
+                Left_ -= rv;
+
+                continue;
+            }
+
+            const ssize_t rv = splice(
+                Src,
+                &Offset_,
+                (direct ? Dst : Pipe[1]),
+                nullptr,
+                std::min(Left_, PIPE_CHUNK_SIZE),
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+            );
+
+            if (rv < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                if (IsAgain()) {
+                    return STATUS_AGAIN;
+                }
+
+                if (IsUnsupported()) {
+                    return Fallback();
+                }
+
+                perror("splice");
+                return STATUS_ERROR;
+            }
+
+            if (rv == 0) {
+                break;
+            }
+
+            if (direct) {
+                Left_ -= rv;
+
+            } else {
+                Pending += rv;
+            }
+        }
+
+        return ((Left_ == 0) ? STATUS_DONE : STATUS_ERROR);
+#else
+        return StepRW();
+#endif
+    }
+
+    TFileTransfer::EStatus TFileTransfer::StepRW() {
+        if (!Buf) {
+            Buf.Reserve(RW_BUF_SIZE);
+        }
+
+        while (Left_ > 0) {
+            if (BufOffset < BufSize) {
+                const size_t size(BufSize - BufOffset);
+                const ssize_t rv = ((DstOffset == -1)
+                    ? write(Dst, Buf.Data() + BufOffset, size)
+                    : pwrite(Dst, Buf.Data() + BufOffset, size, DstOffset)
+                );
+
+                if (rv < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+
+                    if (IsAgain()) {
+                        return STATUS_AGAIN;
+                    }
+
+                    perror("write");
+                    return STATUS_ERROR;
+                }
+
+                BufOffset += rv;
+                Left_ -= rv;
+
+                if (DstOffset != -1) {
+                    DstOffset += rv;
+                }
+
+                continue;
+            }
+
+            const ssize_t rv = pread(Src, Buf.Data(), std::min(Left_, Buf.Capacity()), Offset_);
+
+            if (rv < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                perror("pread");
+                return STATUS_ERROR;
+            }
+
+            if (rv == 0) {
+                break;
+            }
+
+            BufSize = rv;
+            BufOffset = 0;
+            Offset_ += rv;
+        }
+
+        return ((Left_ == 0) ? STATUS_DONE : STATUS_ERROR);
+    }
+
+    static bool CopySparseImpl(int src, int dst, size_t size) {
+        off_t offset(0);
+
+        while ((size_t)offset < size) {
+            off_t data = lseek(src, offset, SEEK_DATA);
+
+            if (data == -1) {
+                if (errno == ENXIO) {
+                    break;
+                }
+
+                if (errno != EINVAL) {
+                    perror("lseek");
+                    return false;
+                }
+
+                // No hole reporting on this filesystem: copy the rest
+                TFileTransfer transfer(src, dst, offset, size - offset, TFileTransfer::MODE_COPY_FILE_RANGE, offset);
+
+                return (transfer.Step() == TFileTransfer::STATUS_DONE);
+            }
+
+            if ((size_t)data >= size) {
+                break;
+            }
+
+            off_t hole = lseek(src, data, SEEK_HOLE);
+
+            if (hole == -1) {
+                perror("lseek");
+                return false;
+            }
+
+            const size_t len(std::min((size_t)hole, size) - data);
+            TFileTransfer transfer(src, dst, data, len, TFileTransfer::MODE_COPY_FILE_RANGE, data);
+
+            if (transfer.Step() != TFileTransfer::STATUS_DONE) {
+                return false;
+            }
+
+            offset = data + len;
+        }
+
+        // Trailing hole
+        if (ftruncate(dst, size) == -1) {
+            perror("ftruncate");
+            return false;
+        }
+
+        return true;
+    }
+
+    bool CopySparse(int src, int dst, size_t size) {
+        // lseek() moves the position TFile::Append() relies on
+        const off_t pos = lseek(src, 0, SEEK_CUR);
+        const bool out = CopySparseImpl(src, dst, size);
+
+        if ((pos != -1) && (lseek(src, pos, SEEK_SET) == -1)) {
+            perror("lseek");
+        }
+
+        return out;
+    }
+}
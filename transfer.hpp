@@ -0,0 +1,188 @@
+#pragma once
+
+#include "file.hpp"
+#include "muhev.hpp"
+#include "str.hpp"
+#include <sys/types.h>
+#include <utility>
+
+namespace NAC {
+    class TFileTransfer {
+    public:
+        enum EMode {
+            MODE_AUTO,
+            MODE_SENDFILE,
+            MODE_COPY_FILE_RANGE,
+            MODE_SPLICE,
+            MODE_RW,
+        };
+
+        enum EStatus {
+            STATUS_DONE,
+            STATUS_AGAIN,
+            STATUS_ERROR,
+        };
+
+    public:
+        TFileTransfer() = delete;
+        TFileTransfer(const TFileTransfer&) = delete;
+        TFileTransfer(TFileTransfer&& right);
+
+        // dstOffset == -1 writes at the current position of dst
+        TFileTransfer(
+            int src,
+            int dst,
+            off_t offset,
+            size_t size,
+            EMode mode = MODE_AUTO,
+            off_t dstOffset = -1
+        );
+
+        TFileTransfer(
+            const TFile& src,
+            int dst,
+            off_t offset,
+            size_t size,
+            EMode mode = MODE_AUTO
+        )
+            : TFileTransfer(src.Fd(), dst, offset, size, mode)
+        {
+        }
+
+        TFileTransfer(
+            const TFile& src,
+            const TFile& dst,
+            off_t offset,
+            size_t size,
+            off_t dstOffset = -1
+        )
+            : TFileTransfer(src.Fd(), dst.Fd(), offset, size, MODE_AUTO, dstOffset)
+        {
+        }
+
+        TFileTransfer& operator=(const TFileTransfer&) = delete;
+        TFileTransfer& operator=(TFileTransfer&&) = delete;
+
+        ~TFileTransfer();
+
+        // Moves as much as possible without blocking, STATUS_AGAIN means
+        // that dst is not writable at the moment and Step() should be
+        // called again once it is.
+        EStatus Step();
+
+        EMode Mode() const {
+            return Mode_;
+        }
+
+        off_t Offset() const {
+            return Offset_;
+        }
+
+        size_t Left() const {
+            return Left_;
+        }
+
+        int GetDst() const {
+            return Dst;
+        }
+
+    private:
+        EStatus StepSendFile();
+        EStatus StepCopyFileRange();
+        EStatus StepSplice();
+        EStatus StepRW();
+
+        EStatus Fallback();
+
+    private:
+        int Src = -1;
+        int Dst = -1;
+        off_t Offset_ = 0;
+        off_t DstOffset = -1;
+        size_t Left_ = 0;
+        EMode Mode_ = MODE_AUTO;
+
+        int Pipe[2] = { -1, -1 };
+        size_t Pending = 0;
+
+        TBlob Buf;
+        size_t BufSize = 0;
+        size_t BufOffset = 0;
+    };
+
+    // Copies size bytes of src to the same offsets in dst (both blocking
+    // files), skipping holes so dst stays sparse. Bytes dst already has
+    // inside src's holes are not zeroed. Copies everything where the
+    // filesystem doesn't report holes. src's file offset is kept.
+    bool CopySparse(int src, int dst, size_t size);
+
+    static inline bool CopySparse(const TFile& src, const TFile& dst) {
+        return CopySparse(src.Fd(), dst.Fd(), src.Size());
+    }
+
+    namespace NMuhEv {
+        // Drives a TFileTransfer from TLoop writability events,
+        // cb(TFileTransfer::EStatus) is called once the transfer is over.
+        template<typename TCb>
+        class TTransferNode : public TNode {
+        public:
+            TTransferNode(TLoop& loop, TFileTransfer&& transfer, TCb&& cb)
+                : TNode(transfer.GetDst(), MUHEV_FILTER_WRITE)
+                , Loop(loop)
+                , Transfer(std::move(transfer))
+                , Cb_(std::forward<TCb>(cb))
+            {
+            }
+
+            ~TTransferNode() {
+                if (Registered) {
+                    Loop.RemoveEvent(*this);
+                }
+            }
+
+            void Start() {
+                Cb(MUHEV_FILTER_WRITE, MUHEV_FLAG_NONE);
+            }
+
+            void Cb(int, int) override {
+                if (Finished) {
+                    return;
+                }
+
+                const auto status = Transfer.Step();
+
+                if (status == TFileTransfer::STATUS_AGAIN) {
+                    if (!Registered) {
+                        Loop.AddEvent(*this, /* mod = */false);
+                        Registered = true;
+                    }
+
+                    return;
+                }
+
+                if (Registered) {
+                    Loop.RemoveEvent(*this);
+                    Registered = false;
+                }
+
+                Finished = true;
+                Cb_(status);
+            }
+
+            bool IsAlive() const override {
+                return !Finished;
+            }
+
+            const TFileTransfer& GetTransfer() const {
+                return Transfer;
+            }
+
+        private:
+            TLoop& Loop;
+            TFileTransfer Transfer;
+            TCb Cb_;
+            bool Registered = false;
+            bool Finished = false;
+        };
+    }
+}
@@ -0,0 +1,117 @@
+#include "crc32c.hpp"
+
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define AC_CRC32C_X86 1
+#include <immintrin.h>
+#endif
+
+namespace NAC {
+    namespace {
+        using TCrc32cImpl = uint32_t(*)(size_t, const char*, uint32_t);
+
+        struct TCrc32cTable {
+            uint32_t Data[8][256];
+
+            TCrc32cTable() {
+                for (uint32_t i = 0; i < 256; ++i) {
+                    uint32_t crc(i);
+
+                    for (int j = 0; j < 8; ++j) {
+                        crc = (crc >> 1) ^ ((crc & 1) ? 0x82f63b78 : 0);
+                    }
+
+                    Data[0][i] = crc;
+                }
+
+                for (uint32_t i = 0; i < 256; ++i) {
+                    for (int j = 1; j < 8; ++j) {
+                        Data[j][i] = (Data[j - 1][i] >> 8) ^ Data[0][Data[j - 1][i] & 0xff];
+                    }
+                }
+            }
+        };
+
+        // Slicing-by-8, expects crc to be already inverted
+        static uint32_t Crc32cSoft(size_t size, const char* data, uint32_t crc) {
+            static const TCrc32cTable table;
+            const auto& t = table.Data;
+            const unsigned char* p((const unsigned char*)data);
+
+            while (size >= 8) {
+                uint64_t word;
+                memcpy(&word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                word = __builtin_bswap64(word);
+#endif
+                word ^= crc;
+
+                crc = t[7][word & 0xff]
+                    ^ t[6][(word >> 8) & 0xff]
+                    ^ t[5][(word >> 16) & 0xff]
+                    ^ t[4][(word >> 24) & 0xff]
+                    ^ t[3][(word >> 32) & 0xff]
+                    ^ t[2][(word >> 40) & 0xff]
+                    ^ t[1][(word >> 48) & 0xff]
+                    ^ t[0][word >> 56];
+
+                p += 8;
+                size -= 8;
+            }
+
+            while (size > 0) {
+                crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+                ++p;
+                --size;
+            }
+
+            return crc;
+        }
+
+#ifdef AC_CRC32C_X86
+        __attribute__((target("sse4.2")))
+        static uint32_t Crc32cHw(size_t size, const char* data, uint32_t crc_) {
+            uint64_t crc(crc_);
+
+            while (size >= 8) {
+                uint64_t word;
+                memcpy(&word, data, sizeof(word));
+                crc = _mm_crc32_u64(crc, word);
+
+                data += 8;
+                size -= 8;
+            }
+
+            while (size > 0) {
+                crc = _mm_crc32_u8(crc, *data);
+                ++data;
+                --size;
+            }
+
+            return crc;
+        }
+
+        static TCrc32cImpl SelectImpl() {
+            __builtin_cpu_init();
+
+            if (__builtin_cpu_supports("sse4.2")) {
+                return Crc32cHw;
+            }
+
+            return Crc32cSoft;
+        }
+
+#else
+        static TCrc32cImpl SelectImpl() {
+            return Crc32cSoft;
+        }
+#endif
+    }
+
+    uint32_t Crc32c(const size_t size, const char* data, uint32_t crc) {
+        static const TCrc32cImpl impl(SelectImpl());
+
+        return ~impl(size, data, ~crc);
+    }
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <sys/types.h>
+#include <cstdint>
+
+namespace NAC {
+    // CRC-32C (Castagnoli), uses SSE4.2 crc32 instruction when available.
+    // Pass the previous result as crc to continue a checksum.
+    uint32_t Crc32c(const size_t size, const char* data, uint32_t crc = 0);
+}
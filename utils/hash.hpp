@@ -0,0 +1,74 @@
+#pragma once
+
+#include <sys/types.h>
+#include <cstdint>
+#include <string.h>
+
+namespace NAC {
+    namespace NHashUtils {
+        static inline uint64_t Mum(uint64_t a, uint64_t b) {
+            const __uint128_t r((__uint128_t)a * b);
+
+            return ((uint64_t)r ^ (uint64_t)(r >> 64));
+        }
+
+        // Maps hash onto [0, n) without division
+        static inline uint64_t FastRange(uint64_t hash, uint64_t n) {
+            return (uint64_t)(((__uint128_t)hash * n) >> 64);
+        }
+
+        static inline uint64_t Load64(const char* data) {
+            uint64_t out;
+            memcpy(&out, data, sizeof(out));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            out = __builtin_bswap64(out);
+#endif
+            return out;
+        }
+
+        static inline uint64_t Load32(const char* data) {
+            uint32_t out;
+            memcpy(&out, data, sizeof(out));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            out = __builtin_bswap32(out);
+#endif
+            return out;
+        }
+
+        // wyhash-style 64-bit hash, stable across platforms
+        static inline uint64_t Hash64(const size_t size, const char* data, uint64_t seed = 0) {
+            static const uint64_t P0 = 0xa0761d6478bd642full;
+            static const uint64_t P1 = 0xe7037ed1a0b428dbull;
+            static const uint64_t P2 = 0x8ebc6af09c88c6e3ull;
+
+            uint64_t h(seed ^ P0);
+            uint64_t a(0);
+            uint64_t b(0);
+            size_t left(size);
+
+            while (left > 16) {
+                h = Mum(Load64(data) ^ P1, Load64(data + 8) ^ h);
+                data += 16;
+                left -= 16;
+            }
+
+            if (left >= 8) {
+                a = Load64(data);
+                b = Load64(data + left - 8);
+
+            } else if (left >= 4) {
+                a = Load32(data);
+                b = Load32(data + left - 4);
+
+            } else if (left > 0) {
+                a = (
+                    ((uint64_t)(unsigned char)data[0] << 16)
+                    | ((uint64_t)(unsigned char)data[left >> 1] << 8)
+                    | (uint64_t)(unsigned char)data[left - 1]
+                );
+            }
+
+            return Mum(Mum(a ^ P1, b ^ h), size ^ P2);
+        }
+    }
+}
@@ -0,0 +1,308 @@
+#include "memmem.hpp"
+
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define AC_MEMMEM_X86 1
+#include <immintrin.h>
+#endif
+
+namespace NAC {
+    namespace {
+        using TMemMemImpl = const char*(*)(size_t, const char*, size_t, const char*);
+
+        static const size_t SIMD_NEEDLE_MAX = 64;
+
+        static inline const char* MemMemScalar(
+            size_t haystackSize,
+            const char* haystack,
+            const size_t needleSize,
+            const char* needle
+        ) {
+            const char* const end(haystack + haystackSize);
+
+            while (haystackSize >= needleSize) {
+                auto* addr = (const char*)memchr(haystack, needle[0], haystackSize - needleSize + 1);
+
+                if (!addr) {
+                    return nullptr;
+                }
+
+                if (memcmp(addr + 1, needle + 1, needleSize - 1) == 0) {
+                    return addr;
+                }
+
+                haystack = addr + 1;
+                haystackSize = end - haystack;
+            }
+
+            return nullptr;
+        }
+
+        // Crochemore-Perrin Two-Way, linear time and constant space
+        static const char* MemMemTwoWay(
+            const size_t haystackSize,
+            const char* haystack_,
+            const size_t l,
+            const char* needle_
+        ) {
+            const unsigned char* h((const unsigned char*)haystack_);
+            const unsigned char* const z(h + haystackSize);
+            const unsigned char* const n((const unsigned char*)needle_);
+            uint64_t byteset[4] = { 0 };
+            size_t shift[256];
+
+            for (size_t i = 0; i < l; ++i) {
+                byteset[n[i] / 64] |= ((uint64_t)1 << (n[i] % 64));
+                shift[n[i]] = i + 1;
+            }
+
+            auto maxSuffix = [n, l](bool reverse, size_t& period) {
+                size_t ip(-1);
+                size_t jp(0);
+                size_t k(1);
+                period = 1;
+
+                while ((jp + k) < l) {
+                    const unsigned char a(n[ip + k]);
+                    const unsigned char b(n[jp + k]);
+
+                    if (a == b) {
+                        if (k == period) {
+                            jp += period;
+                            k = 1;
+
+                        } else {
+                            ++k;
+                        }
+
+                    } else if (reverse ? (a < b) : (a > b)) {
+                        jp += k;
+                        k = 1;
+                        period = jp - ip;
+
+                    } else {
+                        ip = jp++;
+                        k = period = 1;
+                    }
+                }
+
+                return ip;
+            };
+
+            size_t p0;
+            size_t p;
+            size_t ms(maxSuffix(/* reverse = */false, p0));
+            const size_t ms2(maxSuffix(/* reverse = */true, p));
+
+            if ((ms2 + 1) > (ms + 1)) {
+                ms = ms2;
+
+            } else {
+                p = p0;
+            }
+
+            size_t mem0;
+            size_t mem(0);
+
+            if (memcmp(n, n + p, ms + 1) != 0) {
+                mem0 = 0;
+                p = std::max(ms, l - ms - 1) + 1;
+
+            } else {
+                mem0 = l - p;
+            }
+
+            while (true) {
+                if ((size_t)(z - h) < l) {
+                    return nullptr;
+                }
+
+                const unsigned char last(h[l - 1]);
+
+                if (byteset[last / 64] & ((uint64_t)1 << (last % 64))) {
+                    size_t k(l - shift[last]);
+
+                    if (k > 0) {
+                        h += std::max(k, mem);
+                        mem = 0;
+                        continue;
+                    }
+
+                } else {
+                    h += l;
+                    mem = 0;
+                    continue;
+                }
+
+                size_t k(std::max(ms + 1, mem));
+
+                while ((k < l) && (n[k] == h[k])) {
+                    ++k;
+                }
+
+                if (k < l) {
+                    h += k - ms;
+                    mem = 0;
+                    continue;
+                }
+
+                k = ms + 1;
+
+                while ((k > mem) && (n[k - 1] == h[k - 1])) {
+                    --k;
+                }
+
+                if (k <= mem) {
+                    return (const char*)h;
+                }
+
+                h += p;
+                mem = mem0;
+            }
+        }
+
+#ifdef AC_MEMMEM_X86
+        static inline const char* VerifyMask(
+            uint32_t mask,
+            const char* base,
+            const size_t needleSize,
+            const char* needle
+        ) {
+            while (mask != 0) {
+                const unsigned bit(__builtin_ctz(mask));
+
+                if (memcmp(base + bit + 1, needle + 1, needleSize - 2) == 0) {
+                    return base + bit;
+                }
+
+                mask &= mask - 1;
+            }
+
+            return nullptr;
+        }
+
+        static const char* MemMemSSE2(
+            const size_t haystackSize,
+            const char* haystack,
+            const size_t needleSize,
+            const char* needle
+        ) {
+            const __m128i first(_mm_set1_epi8(needle[0]));
+            const __m128i last(_mm_set1_epi8(needle[needleSize - 1]));
+            size_t i(0);
+
+            for (; (i + needleSize - 1 + 16) <= haystackSize; i += 16) {
+                const __m128i blockFirst(_mm_loadu_si128((const __m128i*)(haystack + i)));
+                const __m128i blockLast(_mm_loadu_si128((const __m128i*)(haystack + i + needleSize - 1)));
+                const uint32_t mask(_mm_movemask_epi8(_mm_and_si128(
+                    _mm_cmpeq_epi8(first, blockFirst),
+                    _mm_cmpeq_epi8(last, blockLast)
+                )));
+
+                if (const char* found = VerifyMask(mask, haystack + i, needleSize, needle)) {
+                    return found;
+                }
+            }
+
+            return MemMemScalar(haystackSize - i, haystack + i, needleSize, needle);
+        }
+
+        __attribute__((target("avx2")))
+        static const char* MemMemAVX2(
+            const size_t haystackSize,
+            const char* haystack,
+            const size_t needleSize,
+            const char* needle
+        ) {
+            const __m256i first(_mm256_set1_epi8(needle[0]));
+            const __m256i last(_mm256_set1_epi8(needle[needleSize - 1]));
+            size_t i(0);
+
+            for (; (i + needleSize - 1 + 64) <= haystackSize; i += 64) {
+                const char* const block(haystack + i);
+                const __m256i eq0(_mm256_and_si256(
+                    _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i*)block)),
+                    _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i*)(block + needleSize - 1)))
+                ));
+                const __m256i eq1(_mm256_and_si256(
+                    _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i*)(block + 32))),
+                    _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i*)(block + 32 + needleSize - 1)))
+                ));
+                const __m256i any(_mm256_or_si256(eq0, eq1));
+
+                if (_mm256_testz_si256(any, any)) {
+                    continue;
+                }
+
+                if (const char* found = VerifyMask(_mm256_movemask_epi8(eq0), block, needleSize, needle)) {
+                    return found;
+                }
+
+                if (const char* found = VerifyMask(_mm256_movemask_epi8(eq1), block + 32, needleSize, needle)) {
+                    return found;
+                }
+            }
+
+            for (; (i + needleSize - 1 + 32) <= haystackSize; i += 32) {
+                const __m256i blockFirst(_mm256_loadu_si256((const __m256i*)(haystack + i)));
+                const __m256i blockLast(_mm256_loadu_si256((const __m256i*)(haystack + i + needleSize - 1)));
+                const uint32_t mask(_mm256_movemask_epi8(_mm256_and_si256(
+                    _mm256_cmpeq_epi8(first, blockFirst),
+                    _mm256_cmpeq_epi8(last, blockLast)
+                )));
+
+                if (const char* found = VerifyMask(mask, haystack + i, needleSize, needle)) {
+                    return found;
+                }
+            }
+
+            return MemMemSSE2(haystackSize - i, haystack + i, needleSize, needle);
+        }
+
+        static TMemMemImpl SelectImpl() {
+            __builtin_cpu_init();
+
+            if (__builtin_cpu_supports("avx2")) {
+                return MemMemAVX2;
+            }
+
+            return MemMemSSE2;
+        }
+
+#else
+        static TMemMemImpl SelectImpl() {
+            return MemMemScalar;
+        }
+#endif
+    }
+
+    const char* MemMem(
+        const size_t haystackSize,
+        const char* haystack,
+        const size_t needleSize,
+        const char* needle
+    ) {
+        static const TMemMemImpl impl(SelectImpl());
+
+        if (needleSize == 0) {
+            return haystack;
+        }
+
+        if (needleSize > haystackSize) {
+            return nullptr;
+        }
+
+        if (needleSize == 1) {
+            return (const char*)memchr(haystack, needle[0], haystackSize);
+        }
+
+        if (needleSize > SIMD_NEEDLE_MAX) {
+            return MemMemTwoWay(haystackSize, haystack, needleSize, needle);
+        }
+
+        return impl(haystackSize, haystack, needleSize, needle);
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <sys/types.h>
+
+namespace NAC {
+    // Returns pointer to the first occurrence of needle in haystack or nullptr.
+    // Short needles are matched with SIMD first/last byte filtering (SSE2, or
+    // AVX2 when the CPU supports it), long ones fall back to Two-Way.
+    const char* MemMem(
+        const size_t haystackSize,
+        const char* haystack,
+        const size_t needleSize,
+        const char* needle
+    );
+}
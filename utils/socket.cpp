@@ -1 +1,77 @@
 #include "socket.hpp"
+
+#include <netdb.h>
+#include <unistd.h>
+#include <string.h>
+
+namespace NAC {
+    namespace NSocketUtils {
+        int Listen(const std::string& host, unsigned short port, bool reusePort, int backlog) {
+            addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = AI_PASSIVE;
+
+            addrinfo* list = nullptr;
+            const std::string service(std::to_string(port));
+            const int rv = getaddrinfo((host.empty() ? nullptr : host.c_str()), service.c_str(), &hints, &list);
+
+            if(rv != 0) {
+                fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+                return -1;
+            }
+
+            int fh = -1;
+
+            for(addrinfo* it = list; it; it = it->ai_next) {
+                fh = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+
+                if(fh == -1) {
+                    perror("socket");
+                    continue;
+                }
+
+                int yes = 1;
+
+                if(
+                    (setsockopt(fh, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == 0)
+                    && (!reusePort || SetReusePort(fh))
+                    && (bind(fh, it->ai_addr, it->ai_addrlen) == 0)
+                    && (listen(fh, backlog) == 0)
+                    && SetNonBlocking(fh)
+                ) {
+                    break;
+                }
+
+                perror("listen");
+                close(fh);
+                fh = -1;
+            }
+
+            freeaddrinfo(list);
+
+            return fh;
+        }
+
+        unsigned short LocalPort(int fh) {
+            sockaddr_storage addr;
+            socklen_t len = sizeof(addr);
+
+            if(getsockname(fh, (sockaddr*)&addr, &len) == -1) {
+                perror("getsockname");
+                return 0;
+            }
+
+            if(addr.ss_family == AF_INET) {
+                return ntohs(((sockaddr_in*)&addr)->sin_port);
+            }
+
+            if(addr.ss_family == AF_INET6) {
+                return ntohs(((sockaddr_in6*)&addr)->sin6_port);
+            }
+
+            return 0;
+        }
+    }
+}
@@ -6,6 +6,8 @@
 #include <netinet/tcp.h>
 #include <sys/time.h>
 #include <netinet/in.h>
+#include <fcntl.h>
+#include <string>
 
 namespace NAC {
     namespace NSocketUtils {
@@ -42,5 +44,52 @@ namespace NAC {
 
             return SetTimeout(fh, timeoutMilliseconds);
         }
+
+        static inline bool SetNonBlocking(int fh) {
+            const int flags = fcntl(fh, F_GETFL);
+
+            if((flags == -1) || (fcntl(fh, F_SETFL, flags | O_NONBLOCK) == -1)) {
+                perror("fcntl");
+                return false;
+            }
+
+            return true;
+        }
+
+        static inline bool SetReusePort(int fh) {
+            int yes = 1;
+
+            if(setsockopt(fh, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+                perror("setsockopt");
+                return false;
+            }
+
+            return true;
+        }
+
+        // Lets recv() and poll on this socket busy-wait the NIC queue for
+        // up to us microseconds (SO_BUSY_POLL), false where unsupported
+        static inline bool SetBusyPoll(int fh, int us) {
+#ifdef SO_BUSY_POLL
+            if(setsockopt(fh, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) == -1) {
+                perror("setsockopt");
+                return false;
+            }
+
+            return true;
+#else
+            (void)fh;
+            (void)us;
+
+            return false;
+#endif
+        }
+
+        // Non-blocking listening TCP socket, -1 on error. Empty host means
+        // any address; with reusePort several sockets may share the port.
+        int Listen(const std::string& host, unsigned short port, bool reusePort = false, int backlog = 1024);
+
+        // Local port of a bound socket, 0 on error
+        unsigned short LocalPort(int fh);
     }
 }
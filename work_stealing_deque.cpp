@@ -0,0 +1 @@
+#include "work_stealing_deque.hpp"
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <stddef.h>
+#include <type_traits>
+
+namespace NAC {
+    namespace NUtils {
+        // Chase-Lev work-stealing deque (with the C11 orderings of Le et
+        // al.). The owner thread pushes and pops at the bottom, any thread
+        // may Steal() from the top. T must be trivially copyable, e.g. a
+        // pointer. The buffer grows as needed; old ones are kept until the
+        // deque is destroyed since a thief may still be reading them.
+        template<typename T>
+        class TWorkStealingDeque {
+            static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+        private:
+            struct TArray {
+                const int64_t Capacity;
+                std::unique_ptr<std::atomic<T>[]> Items;
+
+                TArray(int64_t capacity)
+                    : Capacity(capacity)
+                    , Items(new std::atomic<T>[capacity])
+                {
+                }
+
+                T Get(int64_t index) const {
+                    return Items[index & (Capacity - 1)].load(std::memory_order_relaxed);
+                }
+
+                void Put(int64_t index, T value) {
+                    Items[index & (Capacity - 1)].store(value, std::memory_order_relaxed);
+                }
+            };
+
+        public:
+            // capacity must be a power of two
+            TWorkStealingDeque(int64_t capacity = 256)
+                : Array(new TArray(capacity))
+            {
+                Arrays.emplace_back(Array.load(std::memory_order_relaxed));
+            }
+
+            TWorkStealingDeque(const TWorkStealingDeque&) = delete;
+            TWorkStealingDeque(TWorkStealingDeque&&) = delete;
+
+            // Owner only
+            void Push(T value) {
+                const int64_t bottom = Bottom.load(std::memory_order_relaxed);
+                const int64_t top = Top.load(std::memory_order_acquire);
+                TArray* array = Array.load(std::memory_order_relaxed);
+
+                if ((bottom - top) > (array->Capacity - 1)) {
+                    array = Grow(array, top, bottom);
+                }
+
+                array->Put(bottom, value);
+                // Publishes value (and what it points to) to Steal()
+                Bottom.store(bottom + 1, std::memory_order_release);
+            }
+
+            // Owner only, newest first
+            bool Pop(T& out) {
+                const int64_t bottom = Bottom.load(std::memory_order_relaxed) - 1;
+                TArray* array = Array.load(std::memory_order_relaxed);
+
+                Bottom.store(bottom, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                int64_t top = Top.load(std::memory_order_relaxed);
+
+                if (top > bottom) {
+                    Bottom.store(bottom + 1, std::memory_order_relaxed);
+                    return false;
+                }
+
+                out = array->Get(bottom);
+
+                if (top < bottom) {
+                    return true;
+                }
+
+                // The last one: race thieves for it
+                const bool won = Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                Bottom.store(bottom + 1, std::memory_order_relaxed);
+
+                return won;
+            }
+
+            // Any thread, oldest first. May fail spuriously when racing
+            // with another thief or the owner.
+            bool Steal(T& out) {
+                int64_t top = Top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                const int64_t bottom = Bottom.load(std::memory_order_acquire);
+
+                if (top >= bottom) {
+                    return false;
+                }
+
+                out = Array.load(std::memory_order_acquire)->Get(top);
+
+                return Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            }
+
+            // Approximate unless called by the owner. Sequentially
+            // consistent, so it can be used to re-check before sleeping.
+            bool Empty() const {
+                return (Bottom.load() <= Top.load());
+            }
+
+        private:
+            TArray* Grow(TArray* array, int64_t top, int64_t bottom) {
+                TArray* out = new TArray(array->Capacity * 2);
+
+                for (int64_t i = top; i < bottom; ++i) {
+                    out->Put(i, array->Get(i));
+                }
+
+                Arrays.emplace_back(out);
+                Array.store(out, std::memory_order_release);
+
+                return out;
+            }
+
+        private:
+            // Thieves write Top, the owner Bottom: kept on separate lines
+            alignas(64) std::atomic<int64_t> Top{0};
+            alignas(64) std::atomic<int64_t> Bottom{0};
+            std::atomic<TArray*> Array;
+            // Owner only
+            std::vector<std::unique_ptr<TArray>> Arrays;
+        };
+    }
+}
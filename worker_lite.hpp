@@ -28,9 +28,7 @@ namespace NAC {
             }
 
             virtual ~TWorkerLite() {
-                if(Thread) {
-                    pthread_join(*Thread, nullptr);
-                }
+                Join();
 
                 if(ThreadAttr) {
                     pthread_attr_destroy(ThreadAttr.get());
@@ -39,6 +37,15 @@ namespace NAC {
 
             virtual void Run() = 0;
 
+            // Must be called before a subclass is destroyed if Run() may
+            // still be executing
+            void Join() {
+                if(Thread) {
+                    pthread_join(*Thread, nullptr);
+                    Thread.reset();
+                }
+            }
+
         private:
             std::shared_ptr<pthread_t> Thread;
             std::shared_ptr<pthread_attr_t> ThreadAttr;